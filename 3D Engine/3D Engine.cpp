@@ -10,6 +10,7 @@
 #include <Graphics.h>
 #include <Physics.h>
 #include <Input.h>
+#include <Benchmark.h>
 using namespace std;
 GLFWwindow* window;
 
@@ -34,6 +35,9 @@ void Debug()
         std::cout << "Frame Time:" << 1.0 / (double)fps << std::endl;
         std::cout << "Meshes:" << Mesh::count << std::endl;
         std::cout << "Triangles Drawn:" << Mesh::worldTriangleDrawCount << std::endl;
+        std::cout << "Meshlets Culled:" << Mesh::meshletCullCount << "/" << Mesh::meshletCount << std::endl;
+        std::cout << "Meshes Occluded:" << Mesh::occlusionCullCount << " (" << Mesh::occluderCount << " occluders)" << std::endl;
+        std::cout << "Meshes Too Small:" << Mesh::contributionCullCount << " (" << Mesh::contributionCullTriangleCount << " triangles)" << std::endl;
     }
 }
 
@@ -68,18 +72,22 @@ void Init0(GLFWwindow* window)
     glPointSize(2);
 }
 
+// window = nullptr when rendering headless
 void Init(GLFWwindow* window)
 {
-    glfwSetCursorPosCallback(window, OnMouseMoveEvent);
-    glfwSetScrollCallback(window, OnScrollEvent);
-    glfwSetMouseButtonCallback(window, OnMouseButtonEvent);
-    glfwSetKeyCallback(window, OnKeyPressEvent);
-    glfwGetWindowSize(window, &screenWidth, &screenHeight);
-    glfwSetCursorPos(window, screenWidth / 2.0, screenHeight / 2.0);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+    if (window)
+    {
+        glfwSetCursorPosCallback(window, OnMouseMoveEvent);
+        glfwSetScrollCallback(window, OnScrollEvent);
+        glfwSetMouseButtonCallback(window, OnMouseButtonEvent);
+        glfwSetKeyCallback(window, OnKeyPressEvent);
+        glfwGetWindowSize(window, &screenWidth, &screenHeight);
+        glfwSetCursorPos(window, screenWidth / 2.0, screenHeight / 2.0);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_HIDDEN);
+    }
 
-    glLineWidth(2);
-    glPointSize(2);
+    Graphics::SetLineWidth(2);
+    Graphics::SetPointSize(2);
 
     Graphics::matrixMode = true;
 
@@ -114,25 +122,29 @@ void Init(GLFWwindow* window)
 
     planet = new PhysicsObject(500.0, Direction::forward * 1200, Matrix3x3::identity, LoadMeshFromOBJFile("Planet.obj"), new SphereCollider());
     planet->mass = 100000;
+    planet->UseQuaternion();
 
     moon = LoadMeshFromOBJFile("Moon-Lowpoly.obj");
     //moon->localPosition += Direction::forward * 500;
     moon->localScale *= 70;
     moon->localPosition = planet->Position() + 1.3*(500*-Direction::forward + 400*Direction::left) + 100*Direction::up;
 
-    giantText = LoadMeshFromOBJFile("Hello3DWorldText.obj");
+    giantText = LoadMeshFromOBJFileAsync("Hello3DWorldText.obj");
     giantText->localScale *= 2.5;
     giantText->localPosition = Vec3(0, 25, -490);
     
-    spaceShip = LoadMeshFromOBJFile("SpaceShip_2.2.obj");
+    spaceShip = LoadMeshFromOBJFileAsync("SpaceShip_2.2.obj");
     spaceShip->localPosition = Direction::left * 30 + Direction::forward * 10;
+    spaceShip->UseQuaternion();
 
-    spaceShip2 = LoadMeshFromOBJFile("SpaceShip_3.obj");
+    spaceShip2 = LoadMeshFromOBJFileAsync("SpaceShip_3.obj");
     spaceShip2->localPosition = Direction::right * 40 + Direction::forward * 100;
     spaceShip2->localRotation = Matrix3x3::RotY(PI);
+    spaceShip2->UseQuaternion();
 
-    spaceShip3 = LoadMeshFromOBJFile("SpaceShip_5.obj");
+    spaceShip3 = LoadMeshFromOBJFileAsync("SpaceShip_5.obj");
     spaceShip3->localPosition = Direction::right * 20 + Direction::up * 10;
+    spaceShip3->UseQuaternion();
    
     parent = new CubeMesh(3, Vec3(0, 10, 500), Vec3(0, 45, 0));
     child = new CubeMesh(.5, Vec3(0, 0, 2), Vec3(0, 45, 0));
@@ -248,8 +260,9 @@ void Init(GLFWwindow* window)
     //physicsObj->collider->mesh->SetVisibility(true);
     //physicsObj->collider->isTrigger = true;
 
-    bender = LoadMeshFromOBJFile("Bender.obj");
+    bender = LoadMeshFromOBJFileAsync("Bender.obj");
     bender->localRotation = Matrix3x3::RotZ(ToRad(20));
+    bender->UseQuaternion();
     bender->localPosition = Camera::main->Position() + (Camera::main->Forward() + Camera::main->Right() * 3);
     /*
     for (size_t i = 0; i < 500; i++)
@@ -340,25 +353,25 @@ void Update()
 
     if (planet) {
         float planetRotationSpeed = ((2 * PI) / 240) * deltaTime;
-        planet->localRotation = Matrix3x3::RotX(-planetRotationSpeed) * Matrix3x3::RotY(planetRotationSpeed + 0.000001) * planet->localRotation;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
+        planet->localQuaternion = Quaternion::RotX(-planetRotationSpeed) * Quaternion::RotY(planetRotationSpeed + 0.000001) * planet->localQuaternion;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
     }
 
     if (spaceShip)
     {
         float shipRotationSpeed = (10 * PI / 180) * deltaTime;
-        spaceShip->localRotation = Matrix3x3::RotY(-shipRotationSpeed) * spaceShip->localRotation;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
+        spaceShip->localQuaternion = Quaternion::RotY(-shipRotationSpeed) * spaceShip->localQuaternion;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
         spaceShip->localPosition += spaceShip->Forward() * 20 * deltaTime;
     }
     if (spaceShip2)
     {
         float shipRotationSpeed = (5 * PI / 180) * deltaTime;
-        spaceShip2->localRotation = Matrix3x3::RotZ(shipRotationSpeed) * Matrix3x3::RotY(-shipRotationSpeed) * spaceShip2->localRotation;// *spaceShip2->rotation;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
+        spaceShip2->localQuaternion = Quaternion::RotZ(shipRotationSpeed) * Quaternion::RotY(-shipRotationSpeed) * spaceShip2->localQuaternion;// *spaceShip2->rotation;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
         spaceShip2->localPosition += spaceShip2->Forward() * 10 * deltaTime;
     }
     if (spaceShip3)
     {
         float shipRotationSpeed = (20 * PI / 180) * deltaTime;
-        spaceShip3->localRotation = Matrix3x3::RotY(shipRotationSpeed) * Matrix3x3::RotZ(shipRotationSpeed) * spaceShip3->localRotation;// *spaceShip2->rotation;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
+        spaceShip3->localQuaternion = Quaternion::RotY(shipRotationSpeed) * Quaternion::RotZ(shipRotationSpeed) * spaceShip3->localQuaternion;// *spaceShip2->rotation;// MatrixMultiply(YPR(angle * ((screenWidth / 2)), angle * -((screenWidth / 2)), 0), Mesh.meshes[1].rotation);
         spaceShip3->localPosition += spaceShip3->Forward() * 15 * deltaTime;
 
     }
@@ -366,7 +379,7 @@ void Update()
     if (bender)
     {
         bender->localPosition += Direction::left * deltaTime * 0.7;
-        bender->localRotation *= Matrix3x3::RotY(5.0 * deltaTime);
+        bender->localQuaternion *= Quaternion::RotY(5.0 * deltaTime);
     }
 
     /*
@@ -376,9 +389,10 @@ void Update()
     for (int i = 0; i < Mesh::objects.size(); i++)
     {
         Mesh* mesh = Mesh::objects[i];
-        for (int ii = 0; ii < mesh->vertices.size(); ii++)
+        MeshGeometry& geometry = mesh->UniqueGeometry();
+        for (int ii = 0; ii < geometry.vertices.size(); ii++)
         {
-            Vec3* v = &((mesh->vertices))[ii];
+            Vec3* v = &(geometry.vertices)[ii];
 
             //DECAY
             //*v += *v * 0.001*cos(2.0*PI*t*ii);
@@ -402,13 +416,61 @@ void Update()
             //Stretch 3
             //*v += (RandomDirection() * -ii * (0.001 * t * abs(sin(t * .1))));
         }
+        geometry.Build();
     }
     */
 }
 
-int main(void)
+// --headless [frames] [file.ppm]: no window, the scene is drawn by the software Rasterizer at a fixed 60 fps
+// and the last frame is saved.
+int RunHeadless(const int& frames, const string& path)
+{
+    Graphics::software = true;
+    fixedDeltaTime = 1.0 / 60.0;
+    Rasterizer::Resize(screenWidth, screenHeight);
+    Init(nullptr);
+    while (AsyncMeshLoader::Pending() > 0)
+    {
+        AsyncMeshLoader::Update();
+        std::this_thread::yield();
+    }
+
+    for (int frame = 0; frame < frames; frame++)
+    {
+        Rasterizer::Clear();
+        Time();
+        AsyncMeshLoader::Update();
+        Physics();
+        Update();
+        TransformHierarchy::Update();
+        Draw();
+    }
+    if (!Rasterizer::WritePPM(path))
+    {
+        std::cout << "Could not write " << path << std::endl;
+        return -1;
+    }
+    std::cout << frames << " frames, " << Mesh::worldTriangleDrawCount << " triangles in the last, saved to " << path << std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv)
 {
     //GLFWwindow* window;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--benchmark")
+        {
+            RunBenchmarks();
+            return 0;
+        }
+        if (string(argv[i]) == "--headless")
+        {
+            int frames = i + 1 < argc ? atoi(argv[i + 1]) : 1;
+            string path = i + 2 < argc ? argv[i + 2] : "frame.ppm";
+            return RunHeadless(frames > 0 ? frames : 1, path);
+        }
+    }
     
     /* Initialize the library */
     if (!glfwInit())
@@ -438,9 +500,11 @@ int main(void)
         glClear(GL_COLOR_BUFFER_BIT);
         {
             Time();
+            AsyncMeshLoader::Update();
             Input();
             Physics();
             Update();
+            TransformHierarchy::Update();
             Draw();
             Debug();
         }
@@ -0,0 +1,1203 @@
+#pragma once
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <Matrix.h>
+#include <Graphics.h>
+/*
+    Micro benchmarks for the engine's hot paths.
+    Run the executable with the --benchmark argument. Results are printed to the console and no window is opened.
+    Each kernel is timed against its scalar reference so the speedup is visible on the machine it runs on.
+*/
+
+struct Benchmark
+{
+    static float sink;//results are accumulated here so the optimizer can't drop the timed work
+
+    // Average nanoseconds per call of func(i) over the given number of iterations.
+    template <typename Func>
+    static double Run(const int& iterations, Func func)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < iterations; i++)
+        {
+            func(i);
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration<double, std::nano>(end - start).count() / (double)iterations;
+    }
+
+    // before = reference path, after = path under test
+    static void Print(const char* name, const double& beforeNs, const double& afterNs, const char* unit = "ns")
+    {
+        std::cout << std::left << std::setw(28) << name
+            << " before: " << std::setw(8) << std::setprecision(3) << beforeNs << " " << unit
+            << "  after: " << std::setw(8) << std::setprecision(3) << afterNs << " " << unit
+            << "  speedup: " << std::setprecision(3) << (beforeNs / afterNs) << "x" << std::endl;
+    }
+
+    // Largest difference between a kernel and its scalar reference, relative to the reference value (or absolute below 1).
+    static float Error(const float* values, const float* reference, const int& length)
+    {
+        float maxError = 0;
+        for (int i = 0; i < length; i++)
+        {
+            float error = fabs(values[i] - reference[i]) / std::max(1.0f, fabs(reference[i]));
+            maxError = std::max(maxError, error);
+        }
+        return maxError;
+    }
+};
+float Benchmark::sink = 0;
+
+void BenchmarkMatrices()
+{
+    const int count = 1024;
+    const int iterations = 10000000;
+    static Matrix4x4 matrices4x4[count];
+    static Matrix3x3 matrices3x3[count];
+    static Vec4 points4[count];
+    static Matrix4x4 results4x4[count];
+    static Matrix3x3 results3x3[count];
+    static Vec4 results4[count];
+    for (int i = 0; i < count; i++)
+    {
+        Vec3 axis = Vec3(rand() % 100 + 1, rand() % 100, rand() % 100).Normalized();
+        matrices4x4[i] = Matrix4x4::RotAxisAngle(axis, (float)i);
+        matrices4x4[i].m[0][3] = (float)(rand() % 100);
+        matrices4x4[i].m[1][3] = (float)(rand() % 100);
+        matrices4x4[i].m[2][3] = (float)(rand() % 100);
+        matrices3x3[i] = Matrix3x3::RotAxisAngle(axis, (float)i);
+        points4[i] = Vec4(rand() % 100, rand() % 100, rand() % 100, 1);
+    }
+
+    std::cout << "--------MATRIX KERNELS-------" << std::endl;
+#if defined(MATRIX_AVX)
+    std::cout << "Instruction set: AVX" << std::endl;
+#elif defined(MATRIX_SSE)
+    std::cout << "Instruction set: SSE" << std::endl;
+#else
+    std::cout << "Instruction set: scalar only" << std::endl;
+#endif
+
+    // The timings below only mean something if the fast paths agree with the scalar references
+    const float tolerance = 1e-5f;
+    float error4x4 = 0;
+    float errorVec4 = 0;
+    float error3x3 = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Matrix4x4 product = Matrix4x4::Multiply(matrices4x4[i], matrices4x4[(i + 1) & (count - 1)]);
+        Matrix4x4 reference = Matrix4x4::MultiplyScalar(matrices4x4[i], matrices4x4[(i + 1) & (count - 1)]);
+        error4x4 = std::max(error4x4, Benchmark::Error(&product.m[0][0], &reference.m[0][0], 16));
+
+        Vec4 point = matrices4x4[i] * points4[(i + 1) & (count - 1)];
+        Vec4 referencePoint = MultiplyScalar(matrices4x4[i], points4[(i + 1) & (count - 1)]);
+        errorVec4 = std::max(errorVec4, Benchmark::Error(&point.x, &referencePoint.x, 4));
+
+        Matrix3x3 product3x3 = Matrix3x3::Multiply(matrices3x3[i], matrices3x3[(i + 1) & (count - 1)]);
+        Matrix3x3 reference3x3 = Matrix3x3::MultiplyScalar(matrices3x3[i], matrices3x3[(i + 1) & (count - 1)]);
+        error3x3 = std::max(error3x3, Benchmark::Error(&product3x3.m[0][0], &reference3x3.m[0][0], 9));
+    }
+    std::cout << "Max error vs scalar (tolerance " << tolerance << "): Matrix4x4 * Matrix4x4 " << error4x4
+        << ", Matrix4x4 * Vector4 " << errorVec4 << ", Matrix3x3 * Matrix3x3 " << error3x3 << std::endl;
+    if (error4x4 > tolerance || errorVec4 > tolerance || error3x3 > tolerance)
+    {
+        std::cerr << "FAILED: matrix kernels disagree with their scalar references, timings skipped" << std::endl;
+        return;
+    }
+
+    double scalar = Benchmark::Run(iterations, [&](int i) {
+        results4x4[i & (count - 1)] = Matrix4x4::MultiplyScalar(matrices4x4[i & (count - 1)], matrices4x4[(i + 1) & (count - 1)]);
+    });
+    double simd = Benchmark::Run(iterations, [&](int i) {
+        results4x4[i & (count - 1)] = Matrix4x4::Multiply(matrices4x4[i & (count - 1)], matrices4x4[(i + 1) & (count - 1)]);
+    });
+    Benchmark::Print("Matrix4x4 * Matrix4x4", scalar, simd);
+
+    scalar = Benchmark::Run(iterations, [&](int i) {
+        results4[i & (count - 1)] = MultiplyScalar(matrices4x4[i & (count - 1)], points4[(i + 1) & (count - 1)]);
+    });
+    simd = Benchmark::Run(iterations, [&](int i) {
+        results4[i & (count - 1)] = matrices4x4[i & (count - 1)] * points4[(i + 1) & (count - 1)];
+    });
+    Benchmark::Print("Matrix4x4 * Vector4", scalar, simd);
+
+    scalar = Benchmark::Run(iterations, [&](int i) {
+        results3x3[i & (count - 1)] = Matrix3x3::MultiplyScalar(matrices3x3[i & (count - 1)], matrices3x3[(i + 1) & (count - 1)]);
+    });
+    simd = Benchmark::Run(iterations, [&](int i) {
+        results3x3[i & (count - 1)] = Matrix3x3::Multiply(matrices3x3[i & (count - 1)], matrices3x3[(i + 1) & (count - 1)]);
+    });
+    Benchmark::Print("Matrix3x3 * Matrix3x3", scalar, simd);
+
+    // Same work as Transform::TRS() on a 10 deep parent chain (like the CubeMesh chain in Init)
+    const int depth = 10;
+    scalar = Benchmark::Run(iterations / depth, [&](int i) {
+        Matrix4x4 trs = matrices4x4[i & (count - 1)];
+        for (int d = 1; d < depth; d++) {
+            trs = Matrix4x4::MultiplyScalar(trs, matrices4x4[(i + d) & (count - 1)]);
+        }
+        results4x4[i & (count - 1)] = trs;
+    });
+    simd = Benchmark::Run(iterations / depth, [&](int i) {
+        Matrix4x4 trs = matrices4x4[i & (count - 1)];
+        for (int d = 1; d < depth; d++) {
+            trs = Matrix4x4::Multiply(trs, matrices4x4[(i + d) & (count - 1)]);
+        }
+        results4x4[i & (count - 1)] = trs;
+    });
+    Benchmark::Print("TRS (10 deep hierarchy)", scalar, simd);
+
+    // Affine 3x4 against the full 4x4 path it replaces for model/view/TRS matrices
+    static Matrix3x4 affine[count];
+    static Matrix3x4 affineResults[count];
+    static Vec3 points3[count];
+    static Vec3 results3[count];
+    for (int i = 0; i < count; i++)
+    {
+        affine[i] = Matrix3x4(matrices4x4[i]);
+        points3[i] = points4[i];
+    }
+    scalar = Benchmark::Run(iterations, [&](int i) {
+        results3[i & (count - 1)] = matrices4x4[i & (count - 1)] * points4[(i + 1) & (count - 1)];
+    });
+    simd = Benchmark::Run(iterations, [&](int i) {
+        results3[i & (count - 1)] = affine[i & (count - 1)] * points3[(i + 1) & (count - 1)];
+    });
+    Benchmark::Print("Matrix3x4 * Vector3", scalar, simd);
+
+    scalar = Benchmark::Run(iterations / depth, [&](int i) {
+        Matrix4x4 trs = matrices4x4[i & (count - 1)];
+        for (int d = 1; d < depth; d++) {
+            trs = Matrix4x4::Multiply(trs, matrices4x4[(i + d) & (count - 1)]);
+        }
+        results4x4[i & (count - 1)] = trs;
+    });
+    simd = Benchmark::Run(iterations / depth, [&](int i) {
+        Matrix3x4 trs = affine[i & (count - 1)];
+        for (int d = 1; d < depth; d++) {
+            trs = Matrix3x4::Multiply(trs, affine[(i + d) & (count - 1)]);
+        }
+        affineResults[i & (count - 1)] = trs;
+    });
+    Benchmark::Print("TRS 3x4 (10 deep hierarchy)", scalar, simd);
+
+    // Per frame spin of the ships/planet: two elemental rotations composed onto the current orientation
+    static Quaternion orientations[count];
+    static Quaternion quaternionResults[count];
+    for (int i = 0; i < count; i++) {
+        orientations[i] = Quaternion::FromMatrix(matrices3x3[i]);
+    }
+    scalar = Benchmark::Run(iterations, [&](int i) {
+        float angle = (float)(i & 63) * 0.001f;
+        results3x3[i & (count - 1)] = Matrix3x3::RotZ(angle) * Matrix3x3::RotY(-angle) * matrices3x3[i & (count - 1)];
+    });
+    simd = Benchmark::Run(iterations, [&](int i) {
+        float angle = (float)(i & 63) * 0.001f;
+        quaternionResults[i & (count - 1)] = (Quaternion::RotZ(angle) * Quaternion::RotY(-angle) * orientations[i & (count - 1)]).Normalize();
+    });
+    Benchmark::Print("Rotation compose (quat)", scalar, simd);
+
+    for (int i = 0; i < count; i++) {
+        Benchmark::sink += results4x4[i].m[1][2] + results3x3[i].m[1][2] + results4[i].y + results3[i].y + affineResults[i].m[1][2] + quaternionResults[i].y;
+    }
+}
+
+void BenchmarkTransforms()
+{
+    std::cout << "--------TRANSFORM CACHE-------" << std::endl;
+    const int depth = 10;
+    const int iterations = 1000000;
+    Transform chain[depth];
+    for (int i = 1; i < depth; i++)
+    {
+        chain[i].localPosition = Vec3(0, 1, 0);
+        chain[i].localRotation = YPR(0.1, 0.2, 0.3);
+        chain[i].SetParent(&chain[i - 1], false);
+    }
+    Transform& leaf = chain[depth - 1];
+
+    // Before: the root moves every call so the whole chain is rebuilt (what every read used to cost).
+    double rebuild = Benchmark::Run(iterations, [&](int i) {
+        chain[0].localPosition.x = (float)(i & 1);
+        Benchmark::sink += leaf.TRS().m[0][3] + leaf.Position().y + leaf.Scale().z;
+    });
+    // After: nothing moved, reads come straight from the cache.
+    double cachedRead = Benchmark::Run(iterations, [&](int i) {
+        Benchmark::sink += leaf.TRS().m[0][3] + leaf.Position().y + leaf.Scale().z;
+    });
+    Benchmark::Print("TRS+Position+Scale (10 deep)", rebuild, cachedRead);
+}
+
+void BenchmarkHierarchy()
+{
+    std::cout << "--------TRANSFORM HIERARCHY-------" << std::endl;
+    // 1024 roots, each with 4 children, each with 4 children: 21504 transforms over 3 levels
+    const int roots = 1024;
+    const int branching = 4;
+    const int iterations = 50;
+    List<Transform*> all;
+    List<Transform*> leaves;
+    for (int r = 0; r < roots; r++)
+    {
+        Transform* root = new Transform(1, Vec3(r, 0, 0), Vec3(0.1, 0.2, 0.3));
+        all.push_back(root);
+        for (int c = 0; c < branching; c++)
+        {
+            Transform* child = new Transform(1, Vec3(0, c, 0), Vec3(0.3, 0.2, 0.1));
+            child->SetParent(root, false);
+            all.push_back(child);
+            for (int g = 0; g < branching; g++)
+            {
+                Transform* grandChild = new Transform(0.5, Vec3(0, 0, g), Vec3(0.2, 0.1, 0.3));
+                grandChild->SetParent(child, false);
+                all.push_back(grandChild);
+                leaves.push_back(grandChild);
+            }
+        }
+    }
+
+    // Before: roots move, then every world matrix is rebuilt on demand, each read walking its chain up to the root.
+    double lazy = Benchmark::Run(iterations, [&](int i) {
+        for (int r = 0; r < roots; r++) {
+            all[r * (1 + branching + branching * branching)]->localPosition.y = (float)(i & 1);
+        }
+        for (size_t j = 0; j < all.size(); j++) {
+            Benchmark::sink += all[j]->TRS().m[1][3];
+        }
+    });
+    // After: one flat level by level pass (threaded for big levels), each transform only looks at its parent.
+    double flat = Benchmark::Run(iterations, [&](int i) {
+        for (int r = 0; r < roots; r++) {
+            all[r * (1 + branching + branching * branching)]->localPosition.y = (float)(i & 1);
+        }
+        TransformHierarchy::Update();
+    });
+    for (size_t j = 0; j < leaves.size(); j++) {
+        Benchmark::sink += leaves[j]->TRS().m[1][3];
+    }
+    std::cout << all.size() << " transforms, " << ThreadPool::Instance().WorkerCount() << " worker threads, ns per frame" << std::endl;
+    Benchmark::Print("  Refresh all world TRS", lazy, flat);
+
+    for (size_t j = all.size(); j > 0; j--) {
+        delete all[j - 1];
+    }
+}
+
+void BenchmarkBatchTransforms()
+{
+    std::cout << "--------BATCH TRANSFORMS-------" << std::endl;
+    const char* assets[] = { "Bender.obj", "Chair.obj" };
+    for (const char* asset : assets)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(asset);
+        mesh->localPosition = Vec3(3, -2, -40);
+        mesh->localRotation = YPR(0.3, 0.2, 0.1);
+        Matrix4x4 trs = mesh->TRS();//full 4x4 path for the per vertex reference
+        Matrix4x4 mvp = ProjectionMatrix() * trs;
+        List<Vec3> verts = mesh->Vertices();
+        List<Vec3> transformed = List<Vec3>(verts.size());
+        List<Vec4> projected = List<Vec4>(verts.size());
+        const int iterations = 200;
+
+        std::cout << asset << " (" << verts.size() << " vertices), ns per vertex" << std::endl;
+        double perVertex = Benchmark::Run(iterations, [&](int i) {
+            for (size_t j = 0; j < verts.size(); j++) {
+                transformed[j] = (Vec3)(trs * ((Vec4)verts[j]));
+            }
+        }) / verts.size();
+        double batch = Benchmark::Run(iterations, [&](int i) {
+            TransformPoints(trs, verts.data(), transformed.data(), verts.size());
+        }) / verts.size();
+        Benchmark::Print("  TransformPoints", perVertex, batch);
+
+        perVertex = Benchmark::Run(iterations, [&](int i) {
+            for (size_t j = 0; j < verts.size(); j++) {
+                projected[j] = mvp * ((Vec4)verts[j]);
+            }
+        }) / verts.size();
+        batch = Benchmark::Run(iterations, [&](int i) {
+            ProjectPoints(mvp, verts.data(), projected.data(), verts.size());
+        }) / verts.size();
+        Benchmark::Print("  ProjectPoints", perVertex, batch);
+
+        Benchmark::sink += transformed[verts.size() / 2].x + projected[verts.size() / 2].y;
+        delete mesh;
+    }
+}
+
+// The previous OBJLoader::Parse(), kept as BenchmarkOBJLoading's reference: splits the file into words with stringstream,
+// converts with stof and rescans the .mtl on every usemtl. Same output as Parse() for triangle meshes.
+bool ParseOBJReference(const std::string& objFileName, MeshGeometry& geometry)
+{
+    std::string mtlFileName = "";
+    std::ifstream mtlFile;
+
+    // ----------- Read object file -------------
+    List<std::string> strings;
+    std::string line;
+    std::ifstream objFile;
+    objFile.open(OBJLoader::directory + objFileName);
+    if (!objFile.is_open()) {
+        return false;
+    }
+    while (objFile) {
+        // 1st. Gets the next line.
+        // 2nd. Seperates each word from that line then stores each word into the std::strings array.
+        getline(objFile, line);
+        std::string word;
+        std::stringstream ss(line);
+        while (getline(ss, word, ' '))
+        {
+            if (word == "mtllib") {
+                getline(ss, word, ' ');
+                mtlFileName = word;
+            }
+            else {
+                strings.emplace_back(word);
+            }
+        }
+    }
+    objFile.close();
+
+    List<Vec3>& verts = geometry.vertices;
+    List<int>& indices = geometry.indices;
+    List<Triangle>& triangles = geometry.triangles;
+    Material material;
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        std::string objFileSubString = strings[i];
+
+        // if .obj encounters "usemtl" then the next string will be material id.
+        if (objFileSubString == "usemtl")
+        {
+            mtlFile.open(OBJLoader::directory + mtlFileName);
+            if (mtlFile.is_open())
+            {
+                std::string mtlID = strings[++i];
+                bool mtlIDFound = false;
+                while (!mtlIDFound && mtlFile)
+                {
+                    getline(mtlFile, line);
+                    std::string word;
+                    std::stringstream ss(line);
+                    while (!mtlIDFound && getline(ss, word, ' '))
+                    {
+                        if (word == "newmtl")
+                        {
+                            getline(ss, word, ' ');
+                            if (mtlID == word) {
+                                material.name = word;
+                            }
+                        }
+                        else if (mtlID == material.name && word == "Kd") {
+                            getline(ss, word, ' ');
+                            float r = stof(word);
+                            getline(ss, word, ' ');
+                            float g = stof(word);
+                            getline(ss, word, ' ');
+                            float b = stof(word);
+                            material.color = Color(255 * r, 255 * g, 255 * b);
+
+                            mtlIDFound = true;
+                        }
+                    }
+                }
+                mtlFile.close();
+            }
+        }
+        else if (objFileSubString == "v") {
+            float x = stof(strings[++i]);
+            float y = stof(strings[++i]);
+            float z = stof(strings[++i]);
+            verts.emplace_back(Vec3(x, y, z));
+        }
+        //f means the next 3 strings will be the indices for mapping vertices
+        else if (objFileSubString == "f") {
+            int p3Index = stof(strings[++i]) - 1;
+            int p2Index = stof(strings[++i]) - 1;
+            int p1Index = stof(strings[++i]) - 1;
+
+            indices.emplace_back(p1Index);
+            indices.emplace_back(p2Index);
+            indices.emplace_back(p3Index);
+
+            Triangle tri = Triangle((verts)[p1Index], (verts)[p2Index], (verts)[p3Index]);
+            tri.color = material.color;
+            triangles.emplace_back(tri);
+        }
+    }
+
+    return true;
+}
+
+void BenchmarkOBJLoading()
+{
+    std::cout << "--------OBJ LOADING-------" << std::endl;
+    std::cout << ThreadPool::Instance().WorkerCount() << " worker threads" << std::endl;
+    const char* assets[] = { "Chair.obj", "Planet.obj", "Bender.obj", "Camera.obj", "Hello3DWorldText.obj" };
+    for (const char* asset : assets)
+    {
+        const int iterations = 3;
+        MeshGeometry reference;
+        MeshGeometry parsed;
+        double before = Benchmark::Run(iterations, [&](int i) {
+            reference = MeshGeometry();
+            ParseOBJReference(asset, reference);
+            reference.Build();
+        });
+        OBJLoader::parallel = false;
+        double after = Benchmark::Run(iterations, [&](int i) {
+            parsed = MeshGeometry();
+            OBJLoader::Parse(asset, parsed);
+            parsed.Build();
+        });
+        OBJLoader::parallel = true;
+        MeshGeometry parsedParallel;
+        double afterParallel = Benchmark::Run(iterations, [&](int i) {
+            parsedParallel = MeshGeometry();
+            OBJLoader::Parse(asset, parsedParallel);
+            parsedParallel.Build();
+        });
+
+        bool same = reference.vertices.size() == parsed.vertices.size() && reference.indices == parsed.indices &&
+            memcmp(reference.vertices.data(), parsed.vertices.data(), parsed.vertices.size() * sizeof(Vec3)) == 0;
+        same = same && parsedParallel.indices == parsed.indices &&
+            memcmp(parsedParallel.vertices.data(), parsed.vertices.data(), parsed.vertices.size() * sizeof(Vec3)) == 0;
+        for (size_t i = 0; same && i < parsed.triangles.size(); i++)
+        {
+            Color& a = reference.triangles[i].color;
+            Color& b = parsed.triangles[i].color;
+            Color& c = parsedParallel.triangles[i].color;
+            same = a.r == b.r && a.g == b.g && a.b == b.b && c.r == b.r && c.g == b.g && c.b == b.b;
+        }
+
+        // The cache holds the parsed geometry as is, flagged unoptimized so normal loads don't pick it up
+        bool optimize = MeshOptimizer::enabled;
+        MeshOptimizer::enabled = false;
+        MeshGeometry cached;
+        std::string materialLibrary;
+        OBJLoader::Parse(asset, cached, &materialLibrary);
+        cached.Build();
+        MeshCache::Write(asset, cached, materialLibrary);
+        double fromCache = Benchmark::Run(iterations, [&](int i) {
+            cached = MeshGeometry();
+            MeshCache::Read(asset, cached);
+        });
+        MeshOptimizer::enabled = optimize;
+        same = same && cached.indices == parsed.indices && cached.min.x == parsed.min.x && cached.max.z == parsed.max.z &&
+            memcmp(cached.vertices.data(), parsed.vertices.data(), parsed.vertices.size() * sizeof(Vec3)) == 0;
+
+        std::cout << asset << " (" << parsed.triangles.size() << " triangles)" << (same ? "" : " OUTPUT DIFFERS") << std::endl;
+        Benchmark::Print("  Load geometry", before / 1000000.0, after / 1000000.0, "ms");
+        Benchmark::Print("  Load geometry (parallel)", after / 1000000.0, afterParallel / 1000000.0, "ms");
+        Benchmark::Print("  Load from .meshcache", after / 1000000.0, fromCache / 1000000.0, "ms");
+        Benchmark::sink += parsed.vertices.empty() ? 0 : parsed.vertices[0].x;
+    }
+}
+
+void BenchmarkMeshOptimization()
+{
+    std::cout << "--------MESH OPTIMIZATION-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+    const char* assets[] = { "Chair.obj", "Bender.obj", "Planet.obj", "SpaceShip_3.obj", "PescadoText.obj" };
+    for (const char* asset : assets)
+    {
+        std::shared_ptr<MeshGeometry> original = std::make_shared<MeshGeometry>();
+        OBJLoader::Parse(asset, *original);
+        std::shared_ptr<MeshGeometry> optimized = std::make_shared<MeshGeometry>(*original);
+        original->Build();
+        MeshOptimizer::Stats stats;
+        double optimizeTime = Benchmark::Run(1, [&](int i) {
+            stats = MeshOptimizer::Optimize(*optimized);
+        });
+        std::cout << asset << " vertices: " << stats.verticesBefore << " -> " << stats.verticesAfter
+            << "  triangles: " << stats.trianglesBefore << " -> " << stats.trianglesAfter
+            << "  ACMR(" << MeshOptimizer::cacheSize << "): " << std::setprecision(3) << stats.acmrBefore << " -> " << stats.acmrAfter
+            << "  (" << optimizeTime / 1000000.0 << " ms)" << std::endl;
+        optimized->Build();
+
+        Mesh* mesh = new Mesh();
+        mesh->localPosition = Vec3(0, 0, -8) - (original->min + original->max) * 0.5;
+        mesh->localRotation = YPR(0.3, 0.2, 0.1);
+        const int iterations = 100;
+        mesh->SetGeometry(original);
+        double before = Benchmark::Run(iterations, [&](int i) {
+            triBuffer->clear();
+            mesh->TransformTriangles();
+        });
+        size_t drawnBefore = triBuffer->size();
+        mesh->SetGeometry(optimized);
+        double after = Benchmark::Run(iterations, [&](int i) {
+            triBuffer->clear();
+            mesh->TransformTriangles();
+        });
+        size_t drawnAfter = triBuffer->size();
+        triBuffer->clear();
+        Benchmark::Print("  TransformTriangles", before / 1000.0, after / 1000.0, "us");
+        if (drawnBefore != drawnAfter) {
+            std::cout << "  drawn triangles differ: " << drawnBefore << " vs " << drawnAfter << std::endl;
+        }
+        delete mesh;
+    }
+}
+
+void BenchmarkLevelOfDetail()
+{
+    std::cout << "--------LEVEL OF DETAIL-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+
+    // Open scene: the same assets from a few units away out to the planet's distance
+    const char* assets[] = { "Planet.obj", "Bender.obj", "SpaceShip_3.obj", "Chair.obj", "Hello3DWorldText.obj" };
+    const float scales[] = { 50, 1, 1, 1, 0.5 };
+    List<Mesh*> meshes;
+    for (int i = 0; i < 40; i++)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(assets[i % 5]);
+        float distance = 5 * pow(1.15f, (float)i);
+        mesh->localScale *= scales[i % 5];
+        mesh->localPosition = Vec3(sin((float)i) * distance * 0.3f, cos((float)i) * distance * 0.1f, -distance);
+        meshes.emplace_back(mesh);
+    }
+
+    size_t drawn[2];
+    size_t transformed[2];
+    double time[2];
+    for (int lod = 0; lod < 2; lod++)
+    {
+        Graphics::levelOfDetail = lod == 1;
+        time[lod] = Benchmark::Run(20, [&](int i) {
+            triBuffer->clear();
+            transformed[lod] = 0;
+            for (size_t m = 0; m < meshes.size(); m++)
+            {
+                meshes[m]->TransformTriangles();
+                MeshGeometry& level = meshes[m]->SelectLOD();
+                transformed[lod] += level.triangles.size();
+            }
+        });
+        drawn[lod] = triBuffer->size();
+    }
+    triBuffer->clear();
+    std::cout << "40 meshes, 5 to " << (int)(5 * pow(1.15f, 39.0f)) << " units away" << std::endl;
+    std::cout << "  Triangles in meshes:  " << transformed[0] << " -> " << transformed[1] << std::endl;
+    std::cout << "  Triangles drawn:      " << drawn[0] << " -> " << drawn[1] << std::endl;
+    Benchmark::Print("  Transform scene", time[0] / 1000000.0, time[1] / 1000000.0, "ms");
+
+    // A mesh sitting on a threshold, jittering by 2%
+    Mesh* mesh = meshes[1];
+    float hysteresis = Mesh::lodHysteresis;
+    int switches[2] = { 0, 0 };
+    for (int h = 0; h < 2; h++)
+    {
+        Mesh::lodHysteresis = h == 0 ? 0 : hysteresis;
+        Vec3 min = mesh->Geometry().min;
+        Vec3 max = mesh->Geometry().max;
+        float radius = (max - min).Magnitude() * 0.5;
+        float thresholdDepth = radius * screenHeight / tan(fov * 0.5) / Mesh::lodPixelSizes[0];
+        int level = mesh->LODLevel();
+        for (int i = 0; i < 100; i++)
+        {
+            mesh->localPosition = Vec3(0, 0, -thresholdDepth * (i % 2 == 0 ? 0.99f : 1.01f));
+            mesh->SelectLOD();
+            switches[h] += mesh->LODLevel() != level;
+            level = mesh->LODLevel();
+        }
+    }
+    Mesh::lodHysteresis = hysteresis;
+    Graphics::levelOfDetail = true;
+    std::cout << "  Level switches at a threshold over 100 frames: " << switches[0] << " without hysteresis, "
+        << switches[1] << " with" << std::endl;
+
+    for (size_t m = 0; m < meshes.size(); m++) {
+        delete meshes[m];
+    }
+}
+
+void BenchmarkMeshletCulling()
+{
+    std::cout << "--------MESHLET CULLING-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+    Graphics::levelOfDetail = false;
+
+    // Each asset seen whole from a distance, and from close up with most of it off screen
+    const char* assets[] = { "Planet.obj", "Bender.obj", "Chair.obj" };
+    for (int a = 0; a < 3; a++)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(assets[a]);
+        Vec3 min = mesh->Geometry().min;
+        Vec3 max = mesh->Geometry().max;
+        Vec3 center = (min + max) * 0.5;
+        float radius = (max - min).Magnitude() * 0.5;
+        for (int view = 0; view < 2; view++)
+        {
+            mesh->localPosition = (view == 0 ? Vec3(0, 0, -radius * 3) : Vec3(radius * 0.3f, 0, -radius * 0.9f)) - center;
+            mesh->localRotation = YPR(0.3f * view, 0.7f, 0.1f);
+            // Alternated and the fastest of several rounds kept, the difference is small next to run to run noise
+            size_t drawn[2];
+            double time[2] = { DBL_MAX, DBL_MAX };
+            for (int round = 0; round < 6; round++)
+            {
+                for (int culling = 0; culling < 2; culling++)
+                {
+                    Graphics::meshletCulling = culling == 1;
+                    time[culling] = std::min(time[culling], Benchmark::Run(10, [&](int i) {
+                        triBuffer->clear();
+                        Mesh::meshletCount = 0;
+                        Mesh::meshletCullCount = 0;
+                        mesh->TransformTriangles();
+                    }));
+                    drawn[culling] = triBuffer->size();
+                }
+            }
+            triBuffer->clear();
+            std::cout << "  " << assets[a] << (view == 0 ? " (whole)" : " (close)") << ": " << Mesh::meshletCullCount
+                << "/" << Mesh::meshletCount << " meshlets culled, triangles drawn " << drawn[0] << " -> " << drawn[1] << std::endl;
+            Benchmark::Print("    TransformTriangles", time[0] / 1000.0, time[1] / 1000.0, "us");
+        }
+        delete mesh;
+    }
+    Graphics::meshletCulling = true;
+    Graphics::levelOfDetail = true;
+}
+
+void BenchmarkFrustumCulling()
+{
+    std::cout << "--------FRUSTUM CULLING-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+    Matrix4x4 vpMatrix = projectionMatrix * worldToViewMatrix;
+
+    // Meshes scattered all around the camera, about a sixth of them in view
+    const int count = 4096;
+    List<Mesh*> meshes;
+    for (int i = 0; i < count; i++)
+    {
+        Vec3 position = Vec3(rand() % 2000 - 1000, rand() % 2000 - 1000, rand() % 2000 - 1000) * 0.1f;
+        meshes.emplace_back(new CubeMesh(0.5f + (rand() % 100) / 50.0f, position, Vec3(rand() % 7, rand() % 7, rand() % 7)));
+    }
+    TransformHierarchy::Update();
+
+    // Before: two corners projected into a screen space Cube. After: world boxes against the 6 planes.
+    size_t visibleCount[2] = { 0, 0 };
+    double before = Benchmark::Run(100, [&](int i) {
+        visibleCount[0] = 0;
+        for (int m = 0; m < count; m++)
+        {
+            Matrix4x4 trs4x4 = vpMatrix * meshes[m]->TRS();
+            Cube box = Cube(trs4x4 * meshes[m]->bounds->min, trs4x4 * meshes[m]->bounds->max);
+            visibleCount[0] += Camera::InsideViewScreen(box.vertices.data(), 8);
+        }
+    });
+    BoxList boxes;
+    List<uint32_t> visible;
+    double after = Benchmark::Run(100, [&](int i) {
+        boxes.clear();
+        visible.clear();
+        for (int m = 0; m < count; m++) {
+            boxes.Add(meshes[m]->TRS(), meshes[m]->bounds->min, meshes[m]->bounds->max);
+        }
+        Frustum frustum = Frustum::FromViewProjection(projectionMatrix, worldToViewMatrix, nearClippingPlane, farClippingPlane);
+        frustum.CullBoxes(boxes, visible);
+    });
+    visibleCount[1] = visible.size();
+    double test = Benchmark::Run(1000, [&](int i) {
+        visible.clear();
+        Frustum frustum = Frustum::FromViewProjection(projectionMatrix, worldToViewMatrix, nearClippingPlane, farClippingPlane);
+        frustum.CullBoxes(boxes, visible);
+    });
+    std::cout << "  " << count << " meshes, in view " << visibleCount[0] << " -> " << visibleCount[1]
+        << ", plane tests alone " << std::setprecision(3) << test / count << " ns a mesh" << std::endl;
+    Benchmark::Print("  Cull per mesh", before / count, after / count, "ns");
+    for (int m = 0; m < count; m++) {
+        delete meshes[m];
+    }
+}
+
+void BenchmarkCullingTree()
+{
+    std::cout << "--------CULLING TREE-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+
+    // A big sparse world, the scene plus 16k meshes spread over 40km
+    const int count = 16384;
+    List<Mesh*> meshes;
+    for (int i = 0; i < count; i++)
+    {
+        Vec3 position = Vec3(rand() % 4000 - 2000, rand() % 4000 - 2000, rand() % 4000 - 2000) * 10.0f;
+        meshes.emplace_back(new CubeMesh(1.0f + (rand() % 100) / 10.0f, position, Vec3(rand() % 7, rand() % 7, rand() % 7)));
+    }
+    TransformHierarchy::Update();
+    Mesh::SyncCulling();
+
+    // Before: every box rebuilt and tested each frame. After: the tree re-places moved meshes and walks the regions in view.
+    // Run once with the whole view distance and once with a short one, the tree's cost should follow what's visible.
+    float farPlanes[] = { farClippingPlane, -2000 };
+    float defaultFarPlane = farClippingPlane;
+    for (int f = 0; f < 2; f++)
+    {
+        farClippingPlane = farPlanes[f];
+        BoxList boxes;
+        List<uint32_t> flatVisible;
+        double before = Benchmark::Run(100, [&](int i) {
+            boxes.clear();
+            flatVisible.clear();
+            for (int m = 0; m < Mesh::count; m++)
+            {
+                BoundingBox* bounds = Mesh::objects[m]->bounds;
+                if (bounds) {
+                    boxes.Add(Mesh::objects[m]->TRS(), bounds->min, bounds->max);
+                }
+                else {
+                    boxes.Add(Vec3(0, 0, 0), Vec3(FLT_MAX, FLT_MAX, FLT_MAX));
+                }
+            }
+            Frustum frustum = Frustum::FromViewProjection(projectionMatrix, worldToViewMatrix, nearClippingPlane, farClippingPlane);
+            frustum.CullBoxes(boxes, flatVisible);
+        });
+        List<Mesh*> treeVisible;
+        double after = Benchmark::Run(100, [&](int i) {
+            treeVisible.clear();
+            Mesh::SyncCulling();
+            Frustum frustum = Frustum::FromViewProjection(projectionMatrix, worldToViewMatrix, nearClippingPlane, farClippingPlane);
+            Mesh::cullingTree.Cull(frustum, treeVisible);
+        });
+        double walk = Benchmark::Run(100, [&](int i) {
+            treeVisible.clear();
+            Frustum frustum = Frustum::FromViewProjection(projectionMatrix, worldToViewMatrix, nearClippingPlane, farClippingPlane);
+            Mesh::cullingTree.Cull(frustum, treeVisible);
+        });
+        std::cout << "  " << Mesh::count << " meshes, view distance " << -farClippingPlane << ", in view " << flatVisible.size()
+            << " -> " << treeVisible.size() << ", tree walk alone " << std::setprecision(3) << walk / 1000.0 << " us ("
+            << walk / std::max((size_t)1, treeVisible.size()) << " ns a visible mesh)" << std::endl;
+        Benchmark::Print("  Cull per frame", before / 1000.0, after / 1000.0, "us");
+    }
+    farClippingPlane = defaultFarPlane;
+
+    // A tenth of the meshes moving every frame, the hierarchy update queues them and only those are re-placed
+    double hierarchy = Benchmark::Run(100, [&](int i) {
+        for (int m = i % 10; m < count; m += 10) {
+            meshes[m]->localPosition.x += (i & 1) ? 50.0f : -50.0f;
+        }
+        TransformHierarchy::Update();
+    });
+    Mesh::SyncCulling();
+    double moving = Benchmark::Run(100, [&](int i) {
+        for (int m = i % 10; m < count; m += 10) {
+            meshes[m]->localPosition.x += (i & 1) ? 50.0f : -50.0f;
+        }
+        TransformHierarchy::Update();
+        Mesh::SyncCulling();
+    });
+    std::cout << "  Re-placing " << count / 10 << " moved meshes: " << std::setprecision(3) << (moving - hierarchy) / 1000.0
+        << " us a frame (plus " << hierarchy / 1000.0 << " us for the hierarchy update)" << std::endl;
+
+    // Regression: a move whose unlink empties the cells it's moving into used to link the mesh into a freed node
+    CullingTree<Mesh> tree = CullingTree<Mesh>(50000, 12, 16);
+    List<int> ids;
+    for (int i = 0; i < 16; i++) {
+        ids.emplace_back(tree.Add(meshes[i], Vec3(-6000, -6000, -6000), Vec3(1, 1, 1)));
+    }
+    int last = tree.Add(meshes[16], Vec3(-20000, -20000, -20000), Vec3(1, 1, 1));
+    for (size_t i = 0; i < ids.size(); i++) {
+        tree.Remove(ids[i]);
+    }
+    tree.Move(last, Vec3(-6000, -6000, -20000), Vec3(1, 1, 1));
+    List<Mesh*> found;
+    Frustum frustum = Frustum::FromViewProjection(projectionMatrix, Matrix3x4(Matrix3x3(), Vec3(6000, 6000, 19000)), nearClippingPlane, farClippingPlane);
+    tree.Cull(frustum, found);
+    bool kept = found.size() == 1 && found[0] == meshes[16];
+    std::cout << "  Moved into a cell its own unlink emptied: " << (kept ? "found" : "LOST (tree corrupted)") << std::endl;
+    for (int m = 0; m < count; m++) {
+        delete meshes[m];
+    }
+}
+
+void BenchmarkTriangleBuffer()
+{
+    std::cout << "--------TRIANGLE BUFFER-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+
+    const char* assets[] = { "Planet.obj", "Bender.obj", "Chair.obj", "SpaceShip_3.obj" };
+    List<Mesh*> meshes;
+    for (int i = 0; i < 4; i++)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(assets[i]);
+        Vec3 min = mesh->Geometry().min;
+        Vec3 max = mesh->Geometry().max;
+        float radius = (max - min).Magnitude() * 0.5;
+        mesh->localPosition = Vec3((i - 1.5f) * radius, 0, -radius * 3) - (min + max) * 0.5;
+        mesh->localRotation = YPR(0.3f * i, 0.5f, 0.1f);
+        meshes.emplace_back(mesh);
+    }
+    triBuffer->clear();
+    for (size_t m = 0; m < meshes.size(); m++) {
+        meshes[m]->TransformTriangles();
+    }
+    size_t count = triBuffer->size();
+
+    // The old frame buffer: full Triangles, sorted in place by their projected centroid's w
+    List<Triangle> reference = List<Triangle>(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        reference[i].verts[0] = Vec3(triBuffer->x[0][i], triBuffer->y[0][i], 0);
+        reference[i].verts[1] = Vec3(triBuffer->x[1][i], triBuffer->y[1][i], 0);
+        reference[i].verts[2] = Vec3(triBuffer->x[2][i], triBuffer->y[2][i], 0);
+        reference[i].centroid.w = triBuffer->depth[i];
+    }
+    List<Triangle> sortedReference;
+    double before = Benchmark::Run(20, [&](int i) {
+        sortedReference = reference;
+        sort(sortedReference.begin(), sortedReference.end(), [](const Triangle& triA, const Triangle& triB) -> bool {
+            return triA.centroid.w > triB.centroid.w;
+            });
+    });
+    double after = Benchmark::Run(20, [&](int i) {
+        triBuffer->Sort();
+    });
+    bool same = true;
+    for (size_t i = 0; same && i < count; i++) {
+        same = sortedReference[i].centroid.w == triBuffer->depth[triBuffer->order[i]];
+    }
+
+    size_t bytes = sizeof(float) * 10 + sizeof(uint32_t) * 2 + sizeof(uint8_t);
+    std::cout << count << " triangles, " << sizeof(Triangle) << " -> " << bytes << " bytes each ("
+        << count * sizeof(Triangle) / 1024 << " -> " << count * bytes / 1024 << " KB a frame)"
+        << (same ? "" : " ORDER DIFFERS") << std::endl;
+    Benchmark::Print("  Sort", before / 1000.0, after / 1000.0, "us");
+    triBuffer->clear();
+    for (size_t m = 0; m < meshes.size(); m++) {
+        delete meshes[m];
+    }
+}
+
+void BenchmarkDepthSort()
+{
+    std::cout << "--------DEPTH SORT-------" << std::endl;
+    bool temporalSort = Graphics::temporalSort;
+    const size_t counts[] = { 100000, 1000000 };
+    for (size_t count : counts)
+    {
+        // Triangles spread over the screen and 1 to 100 units deep. The next frame turns the camera slightly.
+        triBuffer->clear();
+        List<float> nextDepth = List<float>(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            float x = (rand() % 2001) / 1000.0f - 1;
+            float y = (rand() % 2001) / 1000.0f - 1;
+            float depth = 1 + (rand() % 100000) / 1000.0f;
+            triBuffer->Add(Vec3(x, y, 0), Vec3(x + 0.01f, y, 0), Vec3(x, y + 0.01f, 0), depth, Color::white);
+            nextDepth[i] = depth + 0.0005f * x;
+        }
+        const int iterations = count > 100000 ? 5 : 20;
+
+        // The sort before: std::sort of indices by depth
+        List<uint32_t> reference = List<uint32_t>(count);
+        double before = Benchmark::Run(iterations, [&](int i) {
+            for (size_t t = 0; t < count; t++) {
+                reference[t] = (uint32_t)t;
+            }
+            const float* keys = triBuffer->depth.data();
+            sort(reference.begin(), reference.end(), [keys](const uint32_t& a, const uint32_t& b) -> bool {
+                return keys[a] > keys[b];
+                });
+        });
+
+        Graphics::temporalSort = false;
+        double radix = Benchmark::Run(iterations, [&](int i) {
+            triBuffer->Sort();
+        });
+        bool same = true;
+        for (size_t t = 0; same && t < count; t++) {
+            same = triBuffer->depth[reference[t]] == triBuffer->depth[triBuffer->order[t]];
+        }
+
+        // Last frame's order as the start: the same frame again, then frames alternating between two camera angles
+        Graphics::temporalSort = true;
+        double still = Benchmark::Run(iterations, [&](int i) {
+            triBuffer->previousOrder.swap(triBuffer->order);
+            triBuffer->Sort();
+        });
+        double turning = Benchmark::Run(iterations, [&](int i) {
+            triBuffer->depth.swap(nextDepth);
+            triBuffer->previousOrder.swap(triBuffer->order);
+            triBuffer->Sort();
+        });
+        for (size_t t = 1; same && t < count; t++) {
+            same = triBuffer->depth[triBuffer->order[t - 1]] >= triBuffer->depth[triBuffer->order[t]];
+        }
+
+        std::cout << count << " triangles" << (same ? "" : " ORDER DIFFERS") << std::endl;
+        Benchmark::Print("  Radix sort", before / 1000000.0, radix / 1000000.0, "ms");
+        Benchmark::Print("  Last order, still", before / 1000000.0, still / 1000000.0, "ms");
+        Benchmark::Print("  Last order, turning", before / 1000000.0, turning / 1000000.0, "ms");
+    }
+    triBuffer->clear();
+    Graphics::temporalSort = temporalSort;
+}
+
+void BenchmarkRasterizer()
+{
+    std::cout << "--------SOFTWARE RASTERIZER-------" << std::endl;
+    bool software = Graphics::software;
+    Graphics::software = true;
+    Rasterizer::Resize(1920, 1080);
+
+    // Fill rate: random triangles of a given size (pixels along a side) with depth test and write
+    const float sizes[] = { 8, 32, 128, 512 };
+    for (float size : sizes)
+    {
+        const int count = size < 100 ? 20000 : 1000;
+        List<Vec2> corners;
+        List<float> depths;
+        double area = 0;
+        for (int i = 0; i < count; i++)
+        {
+            float x = (rand() % 1000) / 1000.0f * (1920 - size);
+            float y = (rand() % 1000) / 1000.0f * (1080 - size);
+            Vec2 a = Vec2(x, y);
+            Vec2 b = Vec2(x + size, y + (rand() % 100) / 100.0f * size);
+            Vec2 c = Vec2(x + (rand() % 100) / 100.0f * size, y + size);
+            area += fabs((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x)) * 0.5;
+            // Pixels to -1..1
+            corners.emplace_back(Vec2(a.x / 960.0f - 1, 1 - a.y / 540.0f));
+            corners.emplace_back(Vec2(b.x / 960.0f - 1, 1 - b.y / 540.0f));
+            corners.emplace_back(Vec2(c.x / 960.0f - 1, 1 - c.y / 540.0f));
+            depths.emplace_back(1.0f / (1 + rand() % 100));
+        }
+        // One pixel at a time against 8 at a time (the same when not built with AVX2)
+        double time[2];
+        for (int simd = 0; simd < 2; simd++)
+        {
+            Rasterizer::simd = simd == 1;
+            time[simd] = Benchmark::Run(3, [&](int i) {
+                Rasterizer::Clear();
+                for (int t = 0; t < count; t++)
+                {
+                    Rasterizer::drawColor = 0xFF000000 | (t * 2654435761u >> 8);
+                    Rasterizer::FillTriangle(corners[t * 3], corners[t * 3 + 1], corners[t * 3 + 2], depths[t], depths[t], depths[t]);
+                }
+            });
+        }
+        Rasterizer::simd = true;
+        std::cout << "  " << std::setw(4) << size << " px triangles: " << std::setprecision(4)
+            << count / (time[0] / 1000000000.0) / 1000000.0 << " -> " << count / (time[1] / 1000000000.0) / 1000000.0 << " Mtriangles/s, "
+            << area / (time[0] / 1000000000.0) / 1000000.0 << " -> " << area / (time[1] / 1000000000.0) / 1000000.0 << " Mpixels/s"
+            << "  speedup: " << std::setprecision(3) << time[0] / time[1] << "x" << std::endl;
+    }
+
+    // A scene drawn back to front (painter's sort) against drawn in any order with the depth buffer
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+    const char* assets[] = { "Planet.obj", "Bender.obj", "Chair.obj", "SpaceShip_3.obj" };
+    List<Mesh*> meshes;
+    for (int i = 0; i < 8; i++)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(assets[i % 4]);
+        Vec3 min = mesh->Geometry().min;
+        Vec3 max = mesh->Geometry().max;
+        mesh->localScale *= 4.0f / (max - min).Magnitude();
+        mesh->localPosition = Vec3((i % 4) * 1.5f - 2.25f, (i / 4) * 1.5f - 0.75f, -5.0f - i * 0.5f);
+        mesh->localRotation = YPR(0.3f * i, 0.5f, 0.1f);
+        meshes.emplace_back(mesh);
+    }
+    double frame[2];
+    uint64_t checksum[2] = { 0, 0 };
+    for (int depth = 0; depth < 2; depth++)
+    {
+        Rasterizer::depthTest = depth == 1;
+        frame[depth] = Benchmark::Run(5, [&](int i) {
+            Rasterizer::Clear();
+            triBuffer->clear();
+            for (size_t m = 0; m < meshes.size(); m++) {
+                meshes[m]->TransformTriangles();
+            }
+            triBuffer->Sort();
+            triBuffer->Draw();
+        });
+        for (size_t p = 0; p < Rasterizer::colorBuffer.size(); p++) {
+            checksum[depth] += Rasterizer::colorBuffer[p] != 0xFF000000;
+        }
+    }
+    std::cout << "  " << triBuffer->size() << " triangles at 1920x1080, " << checksum[0] << " / " << checksum[1]
+        << " pixels covered" << std::endl;
+    Benchmark::Print("  Frame (transform + draw)", frame[0] / 1000000.0, frame[1] / 1000000.0, "ms");
+
+    // Drawing alone: one triangle at a time against binned to 64x64 tiles drawn on the ThreadPool
+    double draw[2];
+    for (int binning = 0; binning < 2; binning++)
+    {
+        Rasterizer::binning = binning == 1;
+        draw[binning] = Benchmark::Run(5, [&](int i) {
+            Rasterizer::Clear();
+            triBuffer->Draw();
+        });
+    }
+    Rasterizer::binning = true;
+    std::cout << "  Tiles drawn by " << ThreadPool::Instance().WorkerCount() + 1 << " threads" << std::endl;
+    Benchmark::Print("  Draw", draw[0] / 1000000.0, draw[1] / 1000000.0, "ms");
+    triBuffer->clear();
+    for (size_t m = 0; m < meshes.size(); m++) {
+        delete meshes[m];
+    }
+    Rasterizer::depthTest = true;
+    Graphics::software = software;
+}
+
+void BenchmarkOcclusionCulling()
+{
+    std::cout << "--------OCCLUSION CULLING-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+
+    // A planet close in front of the camera, with a crowd of meshes behind it (some of them peeking out at the sides)
+    List<Mesh*> meshes;
+    Mesh* planet = LoadMeshFromOBJFile("Planet.obj");
+    Vec3 min = planet->Geometry().min;
+    Vec3 max = planet->Geometry().max;
+    planet->localScale *= 16.0f / (max - min).Magnitude();
+    planet->localPosition = Vec3(0, 0, -15) - (min + max) * 0.5 * planet->localScale.x;
+    meshes.emplace_back(planet);
+    const char* assets[] = { "Bender.obj", "Chair.obj", "SpaceShip_3.obj" };
+    for (int i = 0; i < 48; i++)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(assets[i % 3]);
+        min = mesh->Geometry().min;
+        max = mesh->Geometry().max;
+        mesh->localScale *= 3.0f / (max - min).Magnitude();
+        mesh->localPosition = Vec3((i % 8) * 4.0f - 14.0f, (i / 8 % 3) * 4.0f - 4.0f, -30.0f - (i / 24) * 10.0f);
+        mesh->localRotation = YPR(0.3f * i, 0.5f, 0.1f);
+        meshes.emplace_back(mesh);
+    }
+
+    static List<Mesh*> visible;
+    double time[2];
+    size_t drawn[2];
+    for (int culling = 0; culling < 2; culling++)
+    {
+        time[culling] = Benchmark::Run(10, [&](int i) {
+            triBuffer->clear();
+            visible = meshes;
+            Mesh::occlusionCullCount = 0;
+            if (culling == 1) {
+                CullOccluded(visible);
+            }
+            for (size_t m = 0; m < visible.size(); m++) {
+                visible[m]->TransformTriangles();
+            }
+        });
+        drawn[culling] = triBuffer->size();
+    }
+    double pass = Benchmark::Run(10, [&](int i) {
+        visible = meshes;
+        Mesh::occlusionCullCount = 0;
+        CullOccluded(visible);
+    });
+    std::cout << "  " << Mesh::occlusionCullCount << "/" << meshes.size() << " meshes hidden by " << Mesh::occluderCount
+        << " occluders, triangles drawn " << drawn[0] << " -> " << drawn[1] << ", occlusion pass "
+        << std::setprecision(3) << pass / 1000000.0 << " ms" << std::endl;
+    Benchmark::Print("  Transform", time[0] / 1000000.0, time[1] / 1000000.0, "ms");
+    triBuffer->clear();
+    for (size_t m = 0; m < meshes.size(); m++) {
+        delete meshes[m];
+    }
+}
+
+void BenchmarkContributionCulling()
+{
+    std::cout << "--------CONTRIBUTION CULLING-------" << std::endl;
+    Camera::main = camera1;
+    worldToViewMatrix = Camera::main->TRInverse();
+    projectionMatrix = ProjectionMatrix();
+
+    // A crowd stretching from a few meters to kilometers away, most of it only a pixel or less tall
+    List<Mesh*> meshes;
+    const char* assets[] = { "Bender.obj", "Chair.obj", "SpaceShip_3.obj" };
+    for (int i = 0; i < 512; i++)
+    {
+        Mesh* mesh = LoadMeshFromOBJFile(assets[i % 3]);
+        Vec3 min = mesh->Geometry().min;
+        Vec3 max = mesh->Geometry().max;
+        mesh->localScale *= 2.0f / (max - min).Magnitude();
+        float distance = 10.0f * powf(1.015f, (float)i);
+        mesh->localPosition = Vec3((i % 16 - 7.5f) * distance * 0.05f, (i % 5 - 2) * distance * 0.05f, -distance);
+        mesh->localRotation = YPR(0.3f * i, 0.5f, 0.1f);
+        meshes.emplace_back(mesh);
+    }
+    TransformHierarchy::Update();
+
+    // Same selection as Draw()
+    double time[2];
+    size_t drawn[2];
+    for (int culling = 0; culling < 2; culling++)
+    {
+        time[culling] = Benchmark::Run(10, [&](int i) {
+            triBuffer->clear();
+            Mesh::contributionCullCount = 0;
+            Mesh::contributionCullTriangleCount = 0;
+            for (size_t m = 0; m < meshes.size(); m++)
+            {
+                if (culling == 1)
+                {
+                    ScreenSphere sphere = meshes[m]->BoundingSphere();
+                    if (sphere.pixels < Graphics::minScreenSize)
+                    {
+                        Mesh::contributionCullCount++;
+                        Mesh::contributionCullTriangleCount += (int)meshes[m]->SelectLOD(sphere).triangles.size();
+                        continue;
+                    }
+                }
+                meshes[m]->TransformTriangles();
+            }
+        });
+        drawn[culling] = triBuffer->size();
+    }
+    std::cout << "  " << Mesh::contributionCullCount << "/" << meshes.size() << " meshes under " << Graphics::minScreenSize
+        << " px wide (" << Mesh::contributionCullTriangleCount << " triangles), triangles drawn " << drawn[0] << " -> " << drawn[1] << std::endl;
+    Benchmark::Print("  Transform", time[0] / 1000000.0, time[1] / 1000000.0, "ms");
+    triBuffer->clear();
+    for (size_t m = 0; m < meshes.size(); m++) {
+        delete meshes[m];
+    }
+}
+
+void RunBenchmarks()
+{
+    BenchmarkMatrices();
+    BenchmarkTransforms();
+    BenchmarkHierarchy();
+    BenchmarkBatchTransforms();
+    BenchmarkOBJLoading();
+    BenchmarkMeshOptimization();
+    BenchmarkLevelOfDetail();
+    BenchmarkMeshletCulling();
+    BenchmarkFrustumCulling();
+    BenchmarkCullingTree();
+    BenchmarkTriangleBuffer();
+    BenchmarkDepthSort();
+    BenchmarkRasterizer();
+    BenchmarkOcclusionCulling();
+    BenchmarkContributionCulling();
+    std::cout << "(checksum " << Benchmark::sink << ")" << std::endl;
+}
+
+#endif
@@ -0,0 +1,701 @@
+#pragma once
+#ifndef CULLING_H
+#define CULLING_H
+#include <Matrix.h>
+#include <Utility.h>
+#include <math.h>
+#include <cfloat>
+#include <algorithm>
+/*
+    Visibility tests on bounding volumes, so whole groups of triangles can be skipped before any per triangle work.
+    - Frustum: the view volume as 6 inward facing planes, in view space (the camera looks down -z) or world space.
+    - Normal cone: all triangle normals of a cluster lie within an angle of its axis. When the camera sees the cluster's
+      bounding sphere from behind every one of those triangles, none of them can be front facing.
+    - Occlusion: big meshes drawn into a coarse depth buffer, and boxes tested against it (OcclusionBuffer).
+    - CullingTree: a loose octree of world boxes, so the frustum rejects or accepts whole regions at once.
+*/
+
+// The axis aligned box around box min..max under an affine transform, as center and half extent
+inline void TransformBox(const Matrix3x4& transform, const Vec3& min, const Vec3& max, Vec3& center, Vec3& extent)
+{
+    const float(&m)[3][4] = transform.m;
+    center = transform * Vec3((min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f);
+    Vec3 half = Vec3((max.x - min.x) * 0.5f, (max.y - min.y) * 0.5f, (max.z - min.z) * 0.5f);
+    extent = Vec3(
+        fabsf(m[0][0]) * half.x + fabsf(m[0][1]) * half.y + fabsf(m[0][2]) * half.z,
+        fabsf(m[1][0]) * half.x + fabsf(m[1][1]) * half.y + fabsf(m[1][2]) * half.z,
+        fabsf(m[2][0]) * half.x + fabsf(m[2][1]) * half.y + fabsf(m[2][2]) * half.z);
+}
+
+// Boxes as center and half extent, in structure of arrays so they can be tested several at a time
+struct BoxList
+{
+    List<float> centerX;
+    List<float> centerY;
+    List<float> centerZ;
+    List<float> extentX;
+    List<float> extentY;
+    List<float> extentZ;
+
+    size_t size() const { return centerX.size(); }
+
+    void clear()
+    {
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        extentX.clear();
+        extentY.clear();
+        extentZ.clear();
+    }
+
+    void Add(const Vec3& center, const Vec3& extent)
+    {
+        centerX.emplace_back(center.x);
+        centerY.emplace_back(center.y);
+        centerZ.emplace_back(center.z);
+        extentX.emplace_back(extent.x);
+        extentY.emplace_back(extent.y);
+        extentZ.emplace_back(extent.z);
+    }
+
+    // Box min..max under an affine transform, as the axis aligned box around it
+    void Add(const Matrix3x4& transform, const Vec3& min, const Vec3& max)
+    {
+        Vec3 center, extent;
+        TransformBox(transform, min, max, center, extent);
+        Add(center, extent);
+    }
+
+    void Set(const size_t& i, const Vec3& center, const Vec3& extent)
+    {
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+        extentX[i] = extent.x;
+        extentY[i] = extent.y;
+        extentZ[i] = extent.z;
+    }
+
+    // Moves the last box into slot i
+    void RemoveSwap(const size_t& i)
+    {
+        size_t last = size() - 1;
+        Set(i, Vec3(centerX[last], centerY[last], centerZ[last]), Vec3(extentX[last], extentY[last], extentZ[last]));
+        centerX.pop_back();
+        centerY.pop_back();
+        centerZ.pop_back();
+        extentX.pop_back();
+        extentY.pop_back();
+        extentZ.pop_back();
+    }
+};
+
+struct Frustum
+{
+    // xyz = unit normal pointing inside, w = distance term. A point p is inside a plane when dot(normal, p) + w >= 0.
+    Vec4 planes[6];
+
+    // Side planes from the rows of projection * worldToView (clip space -w <= x, y <= w), near/far from the view space
+    // z row (worldToView's third row), so the planes are in world space. Works for the orthographic projection too.
+    static Frustum FromViewProjection(const Matrix4x4& projection, const Matrix3x4& worldToView, const float& nearPlane, const float& farPlane)
+    {
+        Frustum frustum;
+        Matrix4x4 viewProjection = projection * worldToView;
+        const float(&m)[4][4] = viewProjection.m;
+        for (int i = 0; i < 4; i++)
+        {
+            int row = i / 2;
+            float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+            frustum.planes[i] = Vec4(
+                m[3][0] + sign * m[row][0],
+                m[3][1] + sign * m[row][1],
+                m[3][2] + sign * m[row][2],
+                m[3][3] + sign * m[row][3]);
+        }
+        // Near and far are view space z values (negative, in front of the camera)
+        const float(&z)[4] = worldToView.m[2];
+        frustum.planes[4] = Vec4(-z[0], -z[1], -z[2], nearPlane - z[3]);
+        frustum.planes[5] = Vec4(z[0], z[1], z[2], z[3] - farPlane);
+
+        for (int i = 0; i < 6; i++)
+        {
+            Vec4& p = frustum.planes[i];
+            float length = sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+            if (length > 0) {
+                p = Vec4(p.x / length, p.y / length, p.z / length, p.w / length);
+            }
+        }
+        return frustum;
+    }
+
+    // View space planes
+    static Frustum FromProjection(const Matrix4x4& projection, const float& nearPlane, const float& farPlane)
+    {
+        return FromViewProjection(projection, Matrix3x4(), nearPlane, farPlane);
+    }
+
+    // False only if the sphere is completely outside one of the planes
+    bool SphereVisible(const Vec3& center, const float& radius) const
+    {
+        for (int i = 0; i < 6; i++)
+        {
+            const Vec4& p = planes[i];
+            if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    enum Containment { outside, intersecting, inside };
+
+    // Whether a box (center, half extent) is completely outside, partly inside or completely inside the planes
+    Containment Classify(const Vec3& center, const Vec3& extent) const
+    {
+        Containment result = inside;
+        for (int i = 0; i < 6; i++)
+        {
+            const Vec4& p = planes[i];
+            float distance = p.x * center.x + p.y * center.y + p.z * center.z + p.w;
+            float reach = fabsf(p.x) * extent.x + fabsf(p.y) * extent.y + fabsf(p.z) * extent.z;
+            if (distance + reach < 0) {
+                return outside;
+            }
+            if (distance - reach < 0) {
+                result = intersecting;
+            }
+        }
+        return result;
+    }
+
+    // Appends to visible the index of every box not completely outside one of the planes. 4 (SSE) or 8 (AVX) boxes
+    // are tested at a time: a box is outside a plane when its center's distance plus its extent projected on the
+    // normal is negative.
+    void CullBoxes(const BoxList& boxes, List<uint32_t>& visible) const
+    {
+        size_t count = boxes.size();
+        size_t i = 0;
+#if defined(MATRIX_AVX)
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&boxes.centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&boxes.extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+            __m256 outside = _mm256_setzero_ps();
+            for (int p = 0; p < 6; p++)
+            {
+                const Vec4& plane = planes[p];
+                __m256 distance = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+                __m256 reach = _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(fabsf(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.y)), ey)),
+                    _mm256_mul_ps(_mm256_set1_ps(fabsf(plane.z)), ez));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            int mask = _mm256_movemask_ps(outside);
+            for (int k = 0; k < 8; k++)
+            {
+                if (!(mask & (1 << k))) {
+                    visible.emplace_back((uint32_t)(i + k));
+                }
+            }
+        }
+#elif defined(MATRIX_SSE)
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&boxes.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&boxes.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&boxes.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&boxes.extentX[i]);
+            __m128 ey = _mm_loadu_ps(&boxes.extentY[i]);
+            __m128 ez = _mm_loadu_ps(&boxes.extentZ[i]);
+            __m128 outside = _mm_setzero_ps();
+            for (int p = 0; p < 6; p++)
+            {
+                const Vec4& plane = planes[p];
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+                __m128 reach = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey)),
+                    _mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+            }
+            int mask = _mm_movemask_ps(outside);
+            for (int k = 0; k < 4; k++)
+            {
+                if (!(mask & (1 << k))) {
+                    visible.emplace_back((uint32_t)(i + k));
+                }
+            }
+        }
+#endif
+        for (; i < count; i++)
+        {
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; p++)
+            {
+                const Vec4& plane = planes[p];
+                float distance = plane.x * boxes.centerX[i] + plane.y * boxes.centerY[i] + plane.z * boxes.centerZ[i] + plane.w;
+                float reach = fabsf(plane.x) * boxes.extentX[i] + fabsf(plane.y) * boxes.extentY[i] + fabsf(plane.z) * boxes.extentZ[i];
+                outside = distance + reach < 0;
+            }
+            if (!outside) {
+                visible.emplace_back((uint32_t)i);
+            }
+        }
+    }
+};
+
+// True if every triangle of a cluster faces away from the camera. cutoff = sin of the cone's half angle
+// (> 1 when the normals spread too wide to ever cull). All in the same space as the triangle normals.
+inline bool ConeBackfacing(const Vec3& center, const float& radius, const Vec3& coneAxis, const float& cutoff, const Vec3& cameraPosition)
+{
+    float dx = center.x - cameraPosition.x;
+    float dy = center.y - cameraPosition.y;
+    float dz = center.z - cameraPosition.z;
+    float distance = sqrt(dx * dx + dy * dy + dz * dz);
+    // Every point p of the sphere must see the whole cone behind it: dot(p - camera, axis) >= cutoff * |p - camera|
+    return dx * coneAxis.x + dy * coneAxis.y + dz * coneAxis.z >= cutoff * distance + radius * (1.0f + cutoff);
+}
+
+
+// Loose octree of world boxes (center and half extent), each pointing at an object. A node holds boxes whose center is
+// in its cell and whose extent is at most its cell's half size, so everything under it stays within twice its cell
+// (the loose bounds). Boxes go as deep as the existing nodes allow, and a node is only split once it holds more than
+// nodeCapacity of them, so sparse regions stay shallow. Boxes are placed when added and only re-placed when moved.
+// Culling walks the nodes: one outside the frustum skips its subtree, one inside takes its whole subtree without testing
+// any box, and only the nodes on the frustum's boundary test their own boxes. Boxes out of the root's reach are kept
+// apart and always tested.
+template <typename T>
+struct CullingTree
+{
+    struct Node
+    {
+        Vec3 center;
+        float halfSize;// Of the cell
+        int depth;
+        int parent;
+        int children[8];
+        int count;// Boxes in this node and below
+        BoxList boxes;
+        List<int> items;
+    };
+    struct Item
+    {
+        T* object;
+        int node;// -1 while free
+        int slot;
+    };
+    static const int outsideNode = 0;
+    static const int rootNode = 1;
+    int maxDepth;
+    int nodeCapacity;
+    List<Node> nodes;
+    List<Item> items;
+    List<int> freeItems;
+    List<int> freeNodes;
+
+    // The root cell is size wide, centered on the origin
+    CullingTree(const float& size = 50000, const int& maxDepth = 12, const int& nodeCapacity = 16) : maxDepth(maxDepth), nodeCapacity(nodeCapacity)
+    {
+        AddNode(Vec3(0, 0, 0), 0, 0, -1);
+        AddNode(Vec3(0, 0, 0), size * 0.5f, 0, -1);
+    }
+
+    int Add(T* object, const Vec3& center, const Vec3& extent)
+    {
+        int id;
+        if (!freeItems.empty())
+        {
+            id = freeItems.back();
+            freeItems.pop_back();
+        }
+        else
+        {
+            id = (int)items.size();
+            items.emplace_back();
+        }
+        items[id].object = object;
+        Link(id, FindNode(center, extent), center, extent);
+        return id;
+    }
+
+    void Move(const int& id, const Vec3& center, const Vec3& extent)
+    {
+        Item& item = items[id];
+        if (FindNode(center, extent) == item.node)
+        {
+            nodes[item.node].boxes.Set(item.slot, center, extent);
+            return;
+        }
+        // Unlinked before looking up the new node, unlinking can drop emptied cells that lookup would land in
+        Unlink(id);
+        Link(id, FindNode(center, extent), center, extent);
+    }
+
+    void Remove(const int& id)
+    {
+        Unlink(id);
+        items[id].object = nullptr;
+        freeItems.emplace_back(id);
+    }
+
+    size_t size() const { return (size_t)(nodes[outsideNode].count + nodes[rootNode].count); }
+
+    // Appends every object whose box isn't completely outside the frustum
+    void Cull(const Frustum& frustum, List<T*>& visible)
+    {
+        TestBoxes(nodes[outsideNode], frustum, visible);
+        Walk(rootNode, frustum, visible);
+    }
+
+private:
+    List<uint32_t> hits;
+
+    int AddNode(const Vec3& center, const float& halfSize, const int& depth, const int& parent)
+    {
+        int n;
+        if (!freeNodes.empty())
+        {
+            n = freeNodes.back();
+            freeNodes.pop_back();
+        }
+        else
+        {
+            n = (int)nodes.size();
+            nodes.emplace_back();
+        }
+        Node& node = nodes[n];
+        node.center = center;
+        node.halfSize = halfSize;
+        node.depth = depth;
+        node.parent = parent;
+        node.count = 0;
+        for (int i = 0; i < 8; i++) {
+            node.children[i] = -1;
+        }
+        node.boxes.clear();
+        node.items.clear();
+        return n;
+    }
+
+    // Whether a box this big belongs in a child of node n rather than in n itself
+    bool FitsChild(const int& n, const float& size) const
+    {
+        return nodes[n].depth < maxDepth && size <= nodes[n].halfSize * 0.5f;
+    }
+
+    int Octant(const int& n, const Vec3& center) const
+    {
+        const Vec3& c = nodes[n].center;
+        return (center.x >= c.x ? 1 : 0) | (center.y >= c.y ? 2 : 0) | (center.z >= c.z ? 4 : 0);
+    }
+
+    // Deepest existing node whose cell holds the center and is at least twice the extent
+    int FindNode(const Vec3& center, const Vec3& extent) const
+    {
+        float size = std::max(extent.x, std::max(extent.y, extent.z));
+        const Node& root = nodes[rootNode];
+        bool inReach = size <= root.halfSize && fabsf(center.x - root.center.x) <= root.halfSize
+            && fabsf(center.y - root.center.y) <= root.halfSize && fabsf(center.z - root.center.z) <= root.halfSize;
+        if (!inReach) {
+            return outsideNode;
+        }
+        int n = rootNode;
+        while (FitsChild(n, size) && nodes[n].children[Octant(n, center)] >= 0) {
+            n = nodes[n].children[Octant(n, center)];
+        }
+        return n;
+    }
+
+    void AddSlot(const int& id, const int& n, const Vec3& center, const Vec3& extent)
+    {
+        items[id].node = n;
+        items[id].slot = (int)nodes[n].items.size();
+        nodes[n].items.emplace_back(id);
+        nodes[n].boxes.Add(center, extent);
+    }
+
+    void RemoveSlot(const int& n, const int& slot)
+    {
+        Node& node = nodes[n];
+        int moved = node.items.back();
+        node.items[slot] = moved;
+        items[moved].slot = slot;
+        node.items.pop_back();
+        node.boxes.RemoveSwap(slot);
+    }
+
+    void Link(const int& id, const int& n, const Vec3& center, const Vec3& extent)
+    {
+        AddSlot(id, n, center, extent);
+        for (int p = n; p >= 0; p = nodes[p].parent) {
+            nodes[p].count++;
+        }
+        if (n != outsideNode && (int)nodes[n].items.size() > nodeCapacity) {
+            Split(n);
+        }
+    }
+
+    void Unlink(const int& id)
+    {
+        Item& item = items[id];
+        RemoveSlot(item.node, item.slot);
+        for (int p = item.node; p >= 0; p = nodes[p].parent) {
+            nodes[p].count--;
+        }
+        // Empty cells are dropped so objects roaming the world don't grow the tree forever
+        for (int n = item.node; n > rootNode && nodes[n].count == 0; )
+        {
+            int parent = nodes[n].parent;
+            nodes[parent].children[Octant(parent, nodes[n].center)] = -1;
+            freeNodes.emplace_back(n);
+            n = parent;
+        }
+        item.node = -1;
+    }
+
+    // Pushes the boxes small enough for a child down into it, then splits the children that got too full
+    void Split(const int& n)
+    {
+        size_t i = 0;
+        while (i < nodes[n].items.size())
+        {
+            const BoxList& boxes = nodes[n].boxes;
+            Vec3 center = Vec3(boxes.centerX[i], boxes.centerY[i], boxes.centerZ[i]);
+            Vec3 extent = Vec3(boxes.extentX[i], boxes.extentY[i], boxes.extentZ[i]);
+            if (!FitsChild(n, std::max(extent.x, std::max(extent.y, extent.z))))
+            {
+                i++;
+                continue;
+            }
+            int octant = Octant(n, center);
+            if (nodes[n].children[octant] < 0)
+            {
+                float h = nodes[n].halfSize * 0.5f;
+                Vec3 c = nodes[n].center;
+                int child = AddNode(Vec3(c.x + (octant & 1 ? h : -h), c.y + (octant & 2 ? h : -h), c.z + (octant & 4 ? h : -h)), h, nodes[n].depth + 1, n);
+                nodes[n].children[octant] = child;
+            }
+            int child = nodes[n].children[octant];
+            int id = nodes[n].items[i];
+            RemoveSlot(n, (int)i);
+            AddSlot(id, child, center, extent);
+            nodes[child].count++;
+        }
+        for (int c = 0; c < 8; c++)
+        {
+            int child = nodes[n].children[c];
+            if (child >= 0 && (int)nodes[child].items.size() > nodeCapacity) {
+                Split(child);
+            }
+        }
+    }
+
+    void TestBoxes(const Node& node, const Frustum& frustum, List<T*>& visible)
+    {
+        hits.clear();
+        frustum.CullBoxes(node.boxes, hits);
+        for (size_t i = 0; i < hits.size(); i++) {
+            visible.emplace_back(items[node.items[hits[i]]].object);
+        }
+    }
+
+    void Walk(const int& n, const Frustum& frustum, List<T*>& visible)
+    {
+        const Node& node = nodes[n];
+        if (node.count == 0) {
+            return;
+        }
+        float loose = node.halfSize * 2;
+        Frustum::Containment containment = frustum.Classify(node.center, Vec3(loose, loose, loose));
+        if (containment == Frustum::outside) {
+            return;
+        }
+        if (containment == Frustum::inside)
+        {
+            Collect(n, visible);
+            return;
+        }
+        TestBoxes(node, frustum, visible);
+        for (int i = 0; i < 8; i++)
+        {
+            if (node.children[i] >= 0) {
+                Walk(node.children[i], frustum, visible);
+            }
+        }
+    }
+
+    void Collect(const int& n, List<T*>& visible)
+    {
+        const Node& node = nodes[n];
+        for (size_t i = 0; i < node.items.size(); i++) {
+            visible.emplace_back(items[node.items[i]].object);
+        }
+        for (int i = 0; i < 8; i++)
+        {
+            if (node.children[i] >= 0 && nodes[node.children[i]].count > 0) {
+                Collect(node.children[i], visible);
+            }
+        }
+    }
+};
+template <typename T>
+const int CullingTree<T>::outsideNode;
+template <typename T>
+const int CullingTree<T>::rootNode;
+
+// Low resolution depth of the frame's biggest meshes (occluders), so meshes completely behind them can be skipped
+// before they're transformed. Depth is distance in front of the camera, FLT_MAX where nothing was drawn.
+// - Each occluder triangle is filled at texel centers with the distance of its farthest corner, so a texel never
+//   claims to hide anything in front of the surface actually drawn there.
+// - levels[0] is width x height, each next level half the size with the farthest depth of the 2x2 texels under it.
+//   A box is tested on the level where its screen rect spans a few texels.
+// - Rects are grown by a texel before testing, so coverage sampled at texel centers can't hide a box peeking out
+//   past an occluder's silhouette.
+struct OcclusionBuffer
+{
+    struct Level
+    {
+        int width;
+        int height;
+        List<float> depth;
+    };
+    static int width;
+    static int height;
+    static List<Level> levels;
+
+    static void Resize(const int& w, const int& h)
+    {
+        width = w;
+        height = h;
+        levels.clear();
+        int levelWidth = w;
+        int levelHeight = h;
+        while (true)
+        {
+            levels.emplace_back(Level{ levelWidth, levelHeight, List<float>((size_t)levelWidth * levelHeight, FLT_MAX) });
+            if (levelWidth == 1 && levelHeight == 1) {
+                break;
+            }
+            levelWidth = (levelWidth + 1) / 2;
+            levelHeight = (levelHeight + 1) / 2;
+        }
+    }
+
+    static void Clear()
+    {
+        if (!levels.empty()) {
+            std::fill(levels[0].depth.begin(), levels[0].depth.end(), FLT_MAX);
+        }
+    }
+
+    // Corners in -1..1 (y up) with their distance in front of the camera
+    static void AddTriangle(const float& x1, const float& y1, const float& d1, const float& x2, const float& y2, const float& d2,
+        const float& x3, const float& y3, const float& d3)
+    {
+        if (levels.empty()) {
+            return;
+        }
+        // To texels, y down
+        float px1 = (x1 + 1) * 0.5f * width, py1 = (1 - y1) * 0.5f * height;
+        float px2 = (x2 + 1) * 0.5f * width, py2 = (1 - y2) * 0.5f * height;
+        float px3 = (x3 + 1) * 0.5f * width, py3 = (1 - y3) * 0.5f * height;
+        float area = (px2 - px1) * (py3 - py1) - (py2 - py1) * (px3 - px1);
+        if (!(area > 0 || area < 0)) {
+            return;
+        }
+        if (area < 0)
+        {
+            std::swap(px2, px3);
+            std::swap(py2, py3);
+        }
+        // Clamped as floats first, corners can be far off screen
+        int minX = (int)floorf(Clamp(std::min(px1, std::min(px2, px3)), 0, (float)width));
+        int minY = (int)floorf(Clamp(std::min(py1, std::min(py2, py3)), 0, (float)height));
+        int maxX = std::min((int)Clamp(std::max(px1, std::max(px2, px3)), 0, (float)width), width - 1);
+        int maxY = std::min((int)Clamp(std::max(py1, std::max(py2, py3)), 0, (float)height), height - 1);
+        float depth = std::max(d1, std::max(d2, d3));
+        List<float>& buffer = levels[0].depth;
+        for (int y = minY; y <= maxY; y++)
+        {
+            float cy = y + 0.5f;
+            for (int x = minX; x <= maxX; x++)
+            {
+                float cx = x + 0.5f;
+                if ((px2 - px1) * (cy - py1) - (py2 - py1) * (cx - px1) < 0 ||
+                    (px3 - px2) * (cy - py2) - (py3 - py2) * (cx - px2) < 0 ||
+                    (px1 - px3) * (cy - py3) - (py1 - py3) * (cx - px3) < 0) {
+                    continue;
+                }
+                float& texel = buffer[(size_t)y * width + x];
+                texel = std::min(texel, depth);
+            }
+        }
+    }
+
+    // Fills the coarser levels once every occluder is in
+    static void BuildHierarchy()
+    {
+        for (size_t l = 1; l < levels.size(); l++)
+        {
+            const Level& fine = levels[l - 1];
+            Level& coarse = levels[l];
+            for (int y = 0; y < coarse.height; y++)
+            {
+                for (int x = 0; x < coarse.width; x++)
+                {
+                    int fx = x * 2, fy = y * 2;
+                    int fx2 = std::min(fx + 1, fine.width - 1), fy2 = std::min(fy + 1, fine.height - 1);
+                    float depth = std::max(
+                        std::max(fine.depth[(size_t)fy * fine.width + fx], fine.depth[(size_t)fy * fine.width + fx2]),
+                        std::max(fine.depth[(size_t)fy2 * fine.width + fx], fine.depth[(size_t)fy2 * fine.width + fx2]));
+                    coarse.depth[(size_t)y * coarse.width + x] = depth;
+                }
+            }
+        }
+    }
+
+    // True if the screen rect (-1..1, y up), nothing of which is closer than nearest, is hidden everywhere
+    static bool RectOccluded(const float& minX, const float& minY, const float& maxX, const float& maxY, const float& nearest)
+    {
+        if (levels.empty() || maxX < -1 || minX > 1 || maxY < -1 || minY > 1) {
+            return false;
+        }
+        int x0 = std::max((int)(Clamp(minX, -1, 1) * 0.5f * width + 0.5f * width) - 1, 0);
+        int x1 = std::min((int)(Clamp(maxX, -1, 1) * 0.5f * width + 0.5f * width) + 1, width - 1);
+        int y0 = std::max((int)((1 - Clamp(maxY, -1, 1)) * 0.5f * height) - 1, 0);
+        int y1 = std::min((int)((1 - Clamp(minY, -1, 1)) * 0.5f * height) + 1, height - 1);
+        size_t l = 0;
+        while (l + 1 < levels.size() && (x1 - x0 > 3 || y1 - y0 > 3))
+        {
+            x0 /= 2;
+            x1 /= 2;
+            y0 /= 2;
+            y1 /= 2;
+            l++;
+        }
+        const Level& level = levels[l];
+        for (int y = y0; y <= y1; y++)
+        {
+            for (int x = x0; x <= x1; x++)
+            {
+                if (level.depth[(size_t)y * level.width + x] >= nearest) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+int OcclusionBuffer::width = 0;
+int OcclusionBuffer::height = 0;
+List<OcclusionBuffer::Level> OcclusionBuffer::levels;
+
+#endif
@@ -1,12 +1,20 @@
 #pragma once
 #include <Matrix.h>
+#include <Quaternion.h>
 #include <vector>
 #include <algorithm>
 #include <string.h>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <climits>
 #include <Utility.h>;
+#include <ThreadPool.h>
+#include <Culling.h>
+#include <Rasterizer.h>
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
@@ -14,9 +22,11 @@ class Plane;
 struct Point;
 struct Line;
 struct Triangle;
+struct TriangleBuffer;
 class Transform;
 class Mesh;
 class Camera;
+void CancelMeshLoad(Mesh* mesh);
 
 Vec3 lightSource = .25 * Direction::up + Direction::back * .5;
 static float worldScale = 1;
@@ -30,7 +40,6 @@ float aspect = (float)screenHeight / (float)screenWidth;
 
 List<Point>* pointBuffer = new List<Point>();
 List<Line>* lineBuffer = new List<Line>();
-List<Triangle>* triBuffer = new List<Triangle>();
 
 struct Color
 {
@@ -214,10 +223,55 @@ class Transform
 protected:
     Transform* parent = nullptr;
     Transform* root = nullptr;
+
+    // World matrix cache. The local fields are public and written directly all over the engine, so instead of setters
+    // the cache keeps a snapshot of the local state and parent it was built from. Validate() compares against the snapshot
+    // (cheap) and only throws the cached matrices away when something actually changed. Each matrix is then rebuilt lazily
+    // the first time it's read, so a transform that doesn't move never redoes the math.
+    enum CacheFlags { TRS_CACHED = 1, TRS_INVERSE_CACHED = 2, TR_CACHED = 4, TR_INVERSE_CACHED = 8, SCALE_CACHED = 16, ROTATION_CACHED = 32 };
+    int cached = 0;
+    unsigned int version = 1;// Bumped every time the world matrices change, so children know to rebuild theirs.
+    unsigned int parentVersion = 0xFFFFFFFF;// Never matches on the first Validate(), which takes the initial snapshot.
+    Transform* cachedParent = nullptr;
+    Vec3 cachedLocalScale;
+    Vec3 cachedLocalPosition;
+    Matrix3x3 cachedLocalRotation;
+    Quaternion cachedLocalQuaternion;
+    bool useQuaternion = false;
+    Matrix3x4 worldTRS;
+    Matrix3x4 worldTRSInverse;
+    Matrix3x4 worldTR;
+    Matrix3x4 worldTRInverse;
+    Vec3 worldScale;
+    Matrix3x3 worldRotation;
+
+    // Hierarchy bookkeeping for TransformHierarchy (see below)
+    List<Transform*> children;
+    int depth = 0;
+    int hierarchyIndex = -1;
+    friend struct TransformHierarchy;
+
+    void Validate();
+    void ValidateLocal();
+    void SyncQuaternion();
+    void Register();
+    void Attach(Transform* newParent);
+    void UpdateSubtree();
+    bool IsAncestorOf(Transform* transform);
+    const Matrix3x4& CachedTRS();
+    const Matrix3x4& CachedTRSInverse();
+    const Matrix3x4& CachedTR();
+    const Matrix3x4& CachedTRInverse();
+    // Called by Validate() each time the world matrices change. Can run on a pool thread (TransformHierarchy::Update).
+    virtual void OnMoved() {}
 public:
     Vec3 localScale = Vec3(1, 1, 1);
     Vec3 localPosition = Vec3(0, 0, 0);
     Matrix3x3 localRotation = Matrix3x3::identity;
+    // Rotation source when UseQuaternion() is on. localRotation then becomes a derived copy which is rebuilt (from the
+    // renormalized quaternion) the next time the transform is validated, i.e. on any world matrix, Rotation() or Forward() read.
+    // Writing localRotation directly still works: if only the matrix changed, the quaternion is taken from it.
+    Quaternion localQuaternion;
 
     Transform(const float& scale = 1, const Vec3& position = Vec3(0, 0, 0), const Vec3& rotationEuler = Vec3(0, 0, 0))
     {
@@ -227,6 +281,7 @@ public:
         this->localPosition = position;
         this->localRotation = YPR(rotationEuler.x, rotationEuler.y, rotationEuler.z);
         this->root = this;
+        Register();
     }
 
     Transform(const Vec3& scale, const Vec3& position = Vec3(0, 0, 0), const Matrix3x3& rotation = Matrix3x3::identity)
@@ -235,8 +290,44 @@ public:
         this->localPosition = position;
         this->localRotation = rotation;
         this->root = this;
+        Register();
+    }
+
+    // Copies the local state and parent. Children and the cache stay with the original.
+    Transform(const Transform& other)
+    {
+        this->localScale = other.localScale;
+        this->localPosition = other.localPosition;
+        this->localRotation = other.localRotation;
+        this->localQuaternion = other.localQuaternion;
+        this->cachedLocalQuaternion = other.localQuaternion;
+        this->cachedLocalRotation = other.localRotation;
+        this->useQuaternion = other.useQuaternion;
+        this->root = this;
+        Register();
+        if (other.parent) {
+            Attach(other.parent);
+        }
+    }
+
+    Transform& operator=(const Transform& other)
+    {
+        if (this != &other)
+        {
+            this->localScale = other.localScale;
+            this->localPosition = other.localPosition;
+            this->localRotation = other.localRotation;
+            this->localQuaternion = other.localQuaternion;
+            this->useQuaternion = other.useQuaternion;
+            if (other.parent != this->parent && other.parent != this && !IsAncestorOf(other.parent)) {
+                Attach(other.parent);
+            }
+        }
+        return *this;
     }
 
+    virtual ~Transform();
+
     Vec3 Forward() { return Rotation() * Direction::forward; }
     Vec3 Back() { return Rotation() * Direction::back; }
     Vec3 Right() { return Rotation() * Direction::right; }
@@ -244,6 +335,11 @@ public:
     Vec3 Up() { return Rotation() * Direction::up; }
     Vec3 Down() { return Rotation() * Direction::down; }
 
+    // Stores the local rotation as a quaternion (cheaper to compose, renormalized instead of drifting). Starts from the current localRotation.
+    void UseQuaternion(bool enable = true);
+
+    bool UsesQuaternion() { return this->useQuaternion; }
+
     Matrix3x3 Rotation();
 
     Vec3 Position();
@@ -256,6 +352,14 @@ public:
 
     Transform& Root() { return *this->root; }
 
+    const List<Transform*>& Children() { return this->children; }
+
+    // 0 for roots, parent depth + 1 otherwise
+    int Depth() { return this->depth; }
+
+    // Changes whenever this transform's world matrices change (its own local state, its parent or any ancestor).
+    unsigned int Version() { Validate(); return version; }
+
     Matrix4x4 LocalScale4x4();
 
     Matrix4x4 LocalScale4x4Inverse();
@@ -267,17 +371,39 @@ public:
     Matrix4x4 LocalTranslation4x4Inverse();
 
     // 1:Scale, 2:Rotate, 3:Translate
-    Matrix4x4 TRS();
+    Matrix3x4 TRS();
 
     // S^-1 * R^-1 * T^-1
-    Matrix4x4 TRSInverse();
+    Matrix3x4 TRSInverse();
 
     // 1:Rotate, 2:Translate
-    Matrix4x4 TR();
+    Matrix3x4 TR();
 
     // R^-1 * T^-1
-    Matrix4x4 TRInverse();
+    Matrix3x4 TRInverse();
+};
+
+// Every live transform, bucketed by depth in the hierarchy (level 0 = roots). Walking the levels in order visits
+// parents before children, so Update() can refresh every world matrix in one flat pass with each transform only looking
+// one step up, instead of every reader walking its own chain to the root. Transforms are owned by whoever created them
+// (pools, members, the stack), so the levels store pointers; registration is O(1) and SetParent just moves a subtree
+// between levels.
+struct TransformHierarchy
+{
+    static bool enabled;
+    static int parallelThreshold;// Levels at least this big are split across the thread pool
+    static int grainSize;
+    static List<List<Transform*>>* levels;
+
+    static void Register(Transform* transform);
+    static void Unregister(Transform* transform);
+    static void Update();
+    static size_t Count();
 };
+bool TransformHierarchy::enabled = true;
+int TransformHierarchy::parallelThreshold = 2048;
+int TransformHierarchy::grainSize = 512;
+List<List<Transform*>>* TransformHierarchy::levels = new List<List<Transform*>>();
 
 class Cube : public Transform
 {
@@ -363,43 +489,153 @@ public:
     void Draw();
 };
 
+// A run of consecutive triangles of a MeshGeometry, with the bounds to reject it as a whole (Culling.h)
+struct Meshlet
+{
+    int firstTriangle;
+    int triangleCount;
+    Vec3 center;// Bounding sphere of its vertices
+    float radius;
+    Vec3 coneAxis;// Average of its triangle normals
+    float coneCutoff;// sin of the normal cone's half angle, > 1 if the cone is too wide to cull
+};
+
+// A mesh's bounding sphere in world space and how big it is on screen (Mesh::BoundingSphere)
+struct ScreenSphere
+{
+    Vec3 center;
+    float radius;
+    float scale;// Largest axis scale of the mesh, for the spheres of its parts (meshlets)
+    float pixels;// Diameter on screen, FLT_MAX when the camera is inside or behind the sphere
+};
+
+// Geometry shared by every mesh created from the same asset (one parse, one copy in memory). Treat it as read-only
+// once it is registered; Mesh::UniqueGeometry() makes a private copy for meshes that need to edit theirs.
+struct MeshGeometry
+{
+    std::string name;
+    List<Vec3> vertices;
+    List<int> indices;
+    List<Triangle> triangles;// Model space corners and material color, one per 3 indices
+    List<Vec3> triangleNormals;// Model space, unit length
+    List<Vec3> triangleCentroids;
+    Vec3 min;
+    Vec3 max;
+    // Simplified copies for distant instances, each coarser than the one before (MeshSimplifier). Empty for small meshes.
+    List<std::shared_ptr<MeshGeometry>> lods;
+    List<Meshlet> meshlets;// Cover triangles in order
+    static int meshletMaxTriangles;
+
+    // Fills triangles (corners), normals, centroids and bounds from vertices/indices. Call after editing vertices.
+    // calculateBounds = false keeps min/max as they are (already known, e.g. from a mesh cache file).
+    void Build(bool calculateBounds = true);
+
+    // Splits the triangles into meshlets of meshletMaxTriangles consecutive triangles (part of Build()).
+    // MeshOptimizer::ClusterTriangles() orders loaded meshes so each of those runs is compact and faces one way.
+    void BuildMeshlets();
+
+    // Built box spanning min to max (12 triangles, same layout as CubeMesh)
+    static std::shared_ptr<MeshGeometry> Box(const Vec3& min, const Vec3& max);
+
+    // Registry keyed by asset path (or a built-in shape name). Entries live for the rest of the program.
+    static std::unordered_map<std::string, std::shared_ptr<MeshGeometry>> assets;
+
+    static std::shared_ptr<MeshGeometry> Find(const std::string& name)
+    {
+        auto it = assets.find(name);
+        return it != assets.end() ? it->second : nullptr;
+    }
+
+    static void Register(const std::string& name, std::shared_ptr<MeshGeometry> geometry)
+    {
+        geometry->name = name;
+        assets[name] = geometry;
+    }
+
+    static std::shared_ptr<MeshGeometry> Empty()
+    {
+        static std::shared_ptr<MeshGeometry> empty = std::make_shared<MeshGeometry>();
+        return empty;
+    }
+};
+std::unordered_map<std::string, std::shared_ptr<MeshGeometry>> MeshGeometry::assets;
+int MeshGeometry::meshletMaxTriangles = 128;
+
 class Mesh : public Component, public Transform, public ManagedObjectPool<Mesh>
 {
 protected:
     Color color = Color::white;
+    std::shared_ptr<MeshGeometry> geometry = MeshGeometry::Empty();
+    // Per instance colors. By default each triangle has its material color from the geometry; SetColor() paints
+    // the whole mesh, and only per triangle edits (SetTriangleColor) allocate a color list for this instance.
+    bool colorOverride = false;
+    List<Color>* triangleColors = nullptr;
+    // Set while an async load (LoadMeshFromOBJFileAsync) is pending. The mesh holds a placeholder box meanwhile.
+    bool loading = false;
+    friend struct AsyncMeshLoader;
+    // Level drawn last frame (0 = full mesh), kept for the hysteresis
+    int lodLevel = 0;
+    // Entry in cullingTree (-1 if not in it), whether the mesh waits in cullingQueue and whether it's in the pool
+    int cullingItem = -1;
+    bool cullingQueued = false;
+    bool visible = true;
+    void OnMoved() override { QueueCulling(); }
 public:
     static int worldTriangleDrawCount;
-    List<Vec3> vertices;
-    List<int>* indices;
-    List<Triangle>* triangles;
+    // Projected bounding sphere diameter (pixels) below which geometry.lods[i] is drawn instead of the level before.
+    // A mesh has to cross a threshold by lodHysteresis (fraction) to change level.
+    static float lodPixelSizes[3];
+    static float lodHysteresis;
+    static int meshletCount;// Last frame, meshlets looked at and rejected whole
+    static int meshletCullCount;
+    // Meshes covering at least occluderScreenArea (fraction of the screen) are drawn into the OcclusionBuffer, the
+    // biggest maxOccluders of them, plus every mesh marked occluder.
+    static float occluderScreenArea;
+    static int maxOccluders;
+    static int occluderCount;// Last frame
+    static int occlusionCullCount;
+    static int contributionCullCount;// Last frame, meshes too small on screen and the triangles they would have transformed
+    static int contributionCullTriangleCount;
+    // World boxes of the meshes in the pool, for frustum culling. Updated by SyncCulling(), removed when hidden or deleted.
+    static CullingTree<Mesh> cullingTree;
+    // Meshes whose box has to be placed again (moved, new, shown again or given new geometry), so SyncCulling() only
+    // visits those. Filled from Validate(), which TransformHierarchy::Update() can run on several threads.
+    static List<Mesh*> cullingQueue;
+    static std::mutex cullingQueueMutex;
     bool ignoreLighting = false;
     bool forceWireFrame = false;
+    bool occluder = false;
     //Mesh(const Mesh& other) = delete;//disables copying
     BoundingBox* bounds;
 
     Mesh(const float& scale = 1, const Vec3& position = Vec3(0, 0, 0), const Vec3& rotationEuler = Vec3(0, 0, 0))
         : Transform(scale, position, rotationEuler), ManagedObjectPool<Mesh>(this)
     {
-        triangles = new List<Triangle>{};
-        MapVertsToTriangles();
-        SetColor(color);
         bounds = new BoundingBox(this);
+        QueueCulling();
     }
     
     Mesh(const Vec3& scale, const Vec3& position = Vec3(0, 0, 0), const Matrix3x3& rotation = Matrix3x3::identity)
         : Transform(scale, position, rotation), ManagedObjectPool<Mesh>(this)
     {
-        triangles = new List<Triangle>{};
-        MapVertsToTriangles();
-        SetColor(color);
         bounds = new BoundingBox(this);
+        QueueCulling();
     }
 
     virtual ~Mesh()
     {
-        //delete vertices;
-        delete indices;
-        delete triangles;
+        if (loading) {
+            CancelMeshLoad(this);
+        }
+        if (cullingItem >= 0) {
+            cullingTree.Remove(cullingItem);
+        }
+        if (cullingQueued)
+        {
+            std::lock_guard<std::mutex> lock(cullingQueueMutex);
+            cullingQueue.erase(std::find(cullingQueue.begin(), cullingQueue.end(), this));
+        }
+        delete triangleColors;
         delete bounds;
     }
 
@@ -409,12 +645,51 @@ public:
     void SetColor(Color& c);
     Color GetColor() { return this->color; }
 
-    virtual List<Triangle>* MapVertsToTriangles();
+    void SetTriangleColor(const int& triangleIndex, const Color& c);
+    Color GetTriangleColor(const int& triangleIndex);
+
+    void SetGeometry(std::shared_ptr<MeshGeometry> geometry);
+
+    const MeshGeometry& Geometry() { return *this->geometry; }
+
+    bool IsLoading() { return loading; }
+
+    int LODLevel() { return lodLevel; }
+
+    // Picks this frame's level of detail from the bounding sphere's size on screen (lodPixelSizes)
+    MeshGeometry& SelectLOD(const ScreenSphere& sphere);
+    MeshGeometry& SelectLOD() { return SelectLOD(BoundingSphere()); }
+
+    // Copy on write: gives this mesh its own geometry if it's shared, so it can be edited. Call Build() on it afterwards.
+    MeshGeometry& UniqueGeometry();
+
+    const List<Vec3>& Vertices() { return this->geometry->vertices; }
+
+    // Model space triangles (shared, read-only)
+    const List<Triangle>& Triangles() { return this->geometry->triangles; }
 
     //Convert to world coordinates
     List<Vec3> WorldVertices();
 
     void TransformTriangles();
+
+    // Screen rect (-1..1) and nearest distance in front of the camera of the bounds. False when the bounds reach
+    // past the near plane. Needs worldToViewMatrix and projectionMatrix.
+    bool ScreenBounds(Vec2& min, Vec2& max, float& nearest);
+
+    // Draws this frame's front facing triangles into the OcclusionBuffer
+    void RasterizeOccluder();
+
+    // Sphere around the full geometry, scaled by the largest axis scale, and its diameter in pixels. The one measure of
+    // screen size for level of detail and contribution culling. Needs worldToViewMatrix and projectionMatrix.
+    ScreenSphere BoundingSphere();
+
+    // Puts this mesh in cullingQueue, once. Safe to call from several threads for different meshes.
+    void QueueCulling();
+
+    // Adds or moves the world boxes of the queued meshes in cullingTree and empties the queue. With the
+    // TransformHierarchy disabled nothing validates the meshes each frame, so every mesh in the pool is checked instead.
+    static void SyncCulling();
 };
 
 struct Graphics
@@ -437,29 +712,57 @@ struct Graphics
     static bool lighting;
     static bool vfx;
     static bool matrixMode;
+    static bool levelOfDetail;
+    static bool meshletCulling;
+    static bool temporalSort;
+    static bool software;
+    static bool occlusionCulling;
+    static bool contributionCulling;
+    static float minScreenSize;// Pixels, meshes whose bounding sphere is narrower on screen are skipped
+    static bool contributionImpostors;// Skipped meshes still show as one point of their color
 
     static void SetDrawColor(Color color)
     {
-        glColor4ub(color.r, color.g, color.b, color.a);
+        SetDrawColor(color.r, color.g, color.b, color.a);
     }
 
     static void SetDrawColor(float r, float g, float b, float a = 1)
     {
+        if (software)
+        {
+            Rasterizer::drawColor = Rasterizer::Pack(r, g, b, a);
+            return;
+        }
         glColor4ub(r, g, b, a);
     }
 
     static void SetLineWidth(int width)
     {
+        if (software)
+        {
+            Rasterizer::lineWidth = width;
+            return;
+        }
         glLineWidth(width);
     }
 
     static void SetPointSize(int size)
     {
+        if (software)
+        {
+            Rasterizer::pointSize = size;
+            return;
+        }
         glPointSize(size);
     }
 
     static void DrawPoint(Vec2 point)
     {
+        if (software)
+        {
+            Rasterizer::DrawPoint(point);
+            return;
+        }
         glBegin(GL_POINTS);
         glVertex2f(point.x, point.y);
         glEnd();
@@ -467,6 +770,11 @@ struct Graphics
 
     static void DrawLine(Vec2 from, Vec2 to)
     {
+        if (software)
+        {
+            Rasterizer::DrawLine(from, to);
+            return;
+        }
         glBegin(GL_LINES);
         glVertex2f(from.x, from.y);
         glVertex2f(to.x, to.y);
@@ -475,6 +783,13 @@ struct Graphics
 
     static void DrawTriangle(Vec2 p1, Vec2 p2, Vec2 p3)
     {
+        if (software)
+        {
+            Rasterizer::DrawLine(p1, p2);
+            Rasterizer::DrawLine(p2, p3);
+            Rasterizer::DrawLine(p3, p1);
+            return;
+        }
         glBegin(GL_LINES);
         glVertex2f(p1.x, p1.y);
         glVertex2f(p2.x, p2.y);
@@ -489,12 +804,34 @@ struct Graphics
 
     static void DrawTriangleFilled(Vec2 p1, Vec2 p2, Vec2 p3)
     {
+        if (software)
+        {
+            Rasterizer::FillTriangle(p1, p2, p3);
+            return;
+        }
         glBegin(GL_TRIANGLES);
         glVertex2f(p1.x, p1.y);
         glVertex2f(p2.x, p2.y);
         glVertex2f(p3.x, p3.y);
         glEnd();
     }
+
+    // z = per corner depth for the software depth buffer (bigger is closer), ignored by OpenGL
+    static void DrawTriangleFilled(Vec2 p1, Vec2 p2, Vec2 p3, float z1, float z2, float z3)
+    {
+        if (software)
+        {
+            Rasterizer::FillTriangle(p1, p2, p3, z1, z2, z3);
+            return;
+        }
+        DrawTriangleFilled(p1, p2, p3);
+    }
+
+    // Filled triangles are depth tested instead of sorted. Wireframes still need the painter's order.
+    static bool DepthBuffered()
+    {
+        return software && Rasterizer::depthTest && fillTriangles && !displayWireFrames;
+    }
 };
 bool Graphics::frustumCulling = true;
 bool Graphics::backFaceCulling = true;
@@ -514,6 +851,14 @@ bool Graphics::displayWireFrames = false;
 bool Graphics::lighting = true;
 bool Graphics::vfx = false;
 bool Graphics::matrixMode = false;
+bool Graphics::levelOfDetail = true;
+bool Graphics::meshletCulling = true;
+bool Graphics::temporalSort = true;// Start the depth sort from last frame's order
+bool Graphics::software = false;// Draw with the CPU Rasterizer instead of OpenGL (set at startup)
+bool Graphics::occlusionCulling = true;
+bool Graphics::contributionCulling = true;
+float Graphics::minScreenSize = 1.0f;
+bool Graphics::contributionImpostors = false;
 
 // Perspective Projection Matrix
 float persp[4][4] = {
@@ -575,7 +920,7 @@ Matrix4x4 ProjectionMatrix()
     }
 }
 
-Matrix4x4 worldToViewMatrix;
+Matrix3x4 worldToViewMatrix;
 Matrix4x4 projectionMatrix;
 
 struct Point
@@ -719,14 +1064,249 @@ struct Triangle : Plane
     }
 };
 
+// The frame's projected triangles, only what drawing needs: screen positions, a depth key and an RGBA8 color, in
+// parallel arrays (~49 bytes a triangle against a 112 byte Triangle). TransformTriangles() appends, Draw() sorts
+// back to front through an index list, so the arrays themselves are never moved.
+// Sort: depth becomes a 32 bit key whose unsigned order is back to front, and (key, index) pairs are radix sorted
+// (3 passes of 11 bits, stable, passes where every key has the same digit are skipped). While the scene is still,
+// TransformTriangles() emits the same triangles in the same order, so last frame's order is tried first with an
+// insertion sort that gives up after ~n moves.
+struct TriangleBuffer
+{
+    List<float> x[3];
+    List<float> y[3];
+    List<float> z[3];// Per corner depth for the software depth buffer, linear in screen space (1/distance), bigger is closer
+    List<float> depth;// Distance along the view direction (projected w), larger is further
+    List<uint32_t> color;// RGBA8, red in the low byte
+    List<uint8_t> flags;
+    List<uint32_t> order;// Draw order after Sort()
+    List<uint32_t> previousOrder;
+    List<uint32_t> keys;
+    List<uint32_t> sortKeys[2];
+    List<uint32_t> sortIndices[2];
+
+    static const uint8_t wireFrame = 1;
+
+    size_t size() const
+    {
+        return depth.size();
+    }
+
+    void clear()
+    {
+        for (int k = 0; k < 3; k++)
+        {
+            x[k].clear();
+            y[k].clear();
+            z[k].clear();
+        }
+        depth.clear();
+        color.clear();
+        flags.clear();
+        previousOrder.swap(order);
+        order.clear();
+    }
+
+    static uint32_t Pack(const Color& c)
+    {
+        return Rasterizer::Pack(c.r, c.g, c.b, c.a);
+    }
+
+    // p = screen x, y and the corner's z-buffer depth
+    void Add(const Vec3& p1, const Vec3& p2, const Vec3& p3, const float& depthKey, const Color& c, const uint8_t& flag = 0)
+    {
+        x[0].emplace_back(p1.x);
+        y[0].emplace_back(p1.y);
+        z[0].emplace_back(p1.z);
+        x[1].emplace_back(p2.x);
+        y[1].emplace_back(p2.y);
+        z[1].emplace_back(p2.z);
+        x[2].emplace_back(p3.x);
+        y[2].emplace_back(p3.y);
+        z[2].emplace_back(p3.z);
+        depth.emplace_back(depthKey);
+        color.emplace_back(Pack(c));
+        flags.emplace_back(flag);
+    }
+
+    // Larger depth -> smaller key. The float's bits are made to order like unsigned integers (negatives flipped).
+    static uint32_t DepthKey(const float& depth)
+    {
+        uint32_t bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        bits = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+        return ~bits;
+    }
+
+    // Painter's algorithm: furthest first. Drawn in the order added when the depth buffer does the job.
+    void Sort()
+    {
+        size_t n = size();
+        if (Graphics::DepthBuffered())
+        {
+            order.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                order[i] = (uint32_t)i;
+            }
+            return;
+        }
+        keys.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            keys[i] = DepthKey(depth[i]);
+        }
+        if (Graphics::temporalSort && previousOrder.size() == n && n > 0 && InsertionSort(previousOrder, n))
+        {
+            order.swap(previousOrder);
+            return;
+        }
+        RadixSort();
+    }
+
+    // Sorts a permutation in place, false (order left partly sorted) if it needs more than maxMoves moves
+    bool InsertionSort(List<uint32_t>& permutation, const size_t& maxMoves)
+    {
+        size_t moves = 0;
+        for (size_t i = 1; i < permutation.size(); i++)
+        {
+            uint32_t index = permutation[i];
+            uint32_t key = keys[index];
+            size_t j = i;
+            while (j > 0 && keys[permutation[j - 1]] > key)
+            {
+                permutation[j] = permutation[j - 1];
+                j--;
+            }
+            permutation[j] = index;
+            moves += i - j;
+            if (moves > maxMoves) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void RadixSort()
+    {
+        const int bits = 11;
+        const int passes = 3;
+        const uint32_t mask = (1u << bits) - 1;
+        size_t n = size();
+        static uint32_t histograms[passes][1 << bits];
+        memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t key = keys[i];
+            histograms[0][key & mask]++;
+            histograms[1][(key >> bits) & mask]++;
+            histograms[2][key >> (2 * bits)]++;
+        }
+
+        for (int b = 0; b < 2; b++)
+        {
+            sortKeys[b].resize(n);
+            sortIndices[b].resize(n);
+        }
+        memcpy(sortKeys[0].data(), keys.data(), n * sizeof(uint32_t));
+        for (size_t i = 0; i < n; i++) {
+            sortIndices[0][i] = (uint32_t)i;
+        }
+
+        int source = 0;
+        for (int pass = 0; pass < passes; pass++)
+        {
+            uint32_t* histogram = histograms[pass];
+            int shift = pass * bits;
+            if (n == 0 || histogram[(keys[0] >> shift) & mask] == n) {
+                continue;// Every key has the same digit
+            }
+            // Counts to starting offsets
+            uint32_t offset = 0;
+            for (uint32_t d = 0; d <= mask; d++)
+            {
+                uint32_t count = histogram[d];
+                histogram[d] = offset;
+                offset += count;
+            }
+            const uint32_t* keysIn = sortKeys[source].data();
+            const uint32_t* indicesIn = sortIndices[source].data();
+            uint32_t* keysOut = sortKeys[1 - source].data();
+            uint32_t* indicesOut = sortIndices[1 - source].data();
+            for (size_t i = 0; i < n; i++)
+            {
+                uint32_t slot = histogram[(keysIn[i] >> shift) & mask]++;
+                keysOut[slot] = keysIn[i];
+                indicesOut[slot] = indicesIn[i];
+            }
+            source = 1 - source;
+        }
+        order.swap(sortIndices[source]);
+    }
+
+    // Same output as Triangle::Draw() for each triangle, in sorted order. The software backend fills them all at once
+    // (tile binned, in parallel), then draws the edges of the few forced to wireframe on top.
+    void Draw()
+    {
+        if (Graphics::fillTriangles == false)
+        {
+            Graphics::displayWireFrames = true;
+        }
+        bool binned = Graphics::software && Rasterizer::binning && !Graphics::displayWireFrames;
+        if (binned)
+        {
+            const float* xs[3] = { x[0].data(), x[1].data(), x[2].data() };
+            const float* ys[3] = { y[0].data(), y[1].data(), y[2].data() };
+            const float* zs[3] = { z[0].data(), z[1].data(), z[2].data() };
+            Rasterizer::FillTriangles(xs, ys, zs, color.data(), order.data(), order.size());
+        }
+        for (size_t n = 0; n < order.size(); n++)
+        {
+            uint32_t i = order[n];
+            if (binned && !(flags[i] & wireFrame)) {
+                continue;
+            }
+            float r = (float)(color[i] & 0xFF);
+            float g = (float)((color[i] >> 8) & 0xFF);
+            float b = (float)((color[i] >> 16) & 0xFF);
+            Vec2 p1 = Vec2(x[0][i], y[0][i]);
+            Vec2 p2 = Vec2(x[1][i], y[1][i]);
+            Vec2 p3 = Vec2(x[2][i], y[2][i]);
+
+            if (Graphics::matrixMode)
+            {
+                Graphics::SetDrawColor(0, 255, 0);
+            }
+
+            if (Graphics::fillTriangles && !binned)
+            {
+                Graphics::SetDrawColor(r, g, b);
+                Graphics::DrawTriangleFilled(p1, p2, p3, z[0][i], z[1][i], z[2][i]);
+            }
+
+            if (Graphics::displayWireFrames || (flags[i] & wireFrame))
+            {
+                if (Graphics::fillTriangles)
+                {
+                    float c = Clamp(1.0 / (0.000001 + (r + g + b) / 3), 0, 255);
+                    Graphics::SetDrawColor(c, c, c);
+                }
+                Graphics::DrawLine(p1, p2);
+                Graphics::DrawLine(p2, p3);
+                Graphics::DrawLine(p3, p1);
+            }
+        }
+        Graphics::SetDrawColor(255, 255, 255);
+    }
+};
+TriangleBuffer* triBuffer = new TriangleBuffer();
+
 //-------------------------------TRANSFORM---------------------------------------------
 
-Vec3 ExtractPosition(const Matrix4x4& trs)
+Vec3 ExtractPosition(const Matrix3x4& trs)
 {
     return { trs.m[0][3], trs.m[1][3], trs.m[2][3] };
 }
 
-Vec3 ExtractScale(const Matrix4x4& trs) {
+Vec3 ExtractScale(const Matrix3x4& trs) {
     Vec3 c1 = { trs.m[0][0], trs.m[1][0], trs.m[2][0] };
     Vec3 c2 = { trs.m[0][1], trs.m[1][1], trs.m[2][1] };
     Vec3 c3 = { trs.m[0][2], trs.m[1][2], trs.m[2][2] };
@@ -735,7 +1315,7 @@ Vec3 ExtractScale(const Matrix4x4& trs) {
 
 // Pass scale parameter if already known since finding the rotation matrix for a TRS matrix 
 // requires the scale vector, which finding can be expensive.
-Matrix3x3 ExtractRotation(const Matrix4x4 trs, Vec3* scale = NULL)
+Matrix3x3 ExtractRotation(const Matrix3x4& trs, Vec3* scale = NULL)
 {
     static Vec3 v = Vec3::zero;
     Vec3 *s = &v;
@@ -769,16 +1349,93 @@ struct TRSInfo
     }
 };
 
-TRSInfo ExtractTRS(Matrix4x4& trs)
+TRSInfo ExtractTRS(const Matrix3x4& trs)
 {
     Vec3 scale = ExtractScale(trs);
     return TRSInfo(scale, ExtractPosition(trs), ExtractRotation(trs, &scale));
 }
 
+void Transform::Validate()
+{
+    if (parent) {
+        parent->Validate();
+    }
+    ValidateLocal();
+}
+
+// Validate() without walking up, for when the parent is known to be up to date already.
+void Transform::ValidateLocal()
+{
+    if (useQuaternion) {
+        SyncQuaternion();
+    }
+    unsigned int currentParentVersion = parent ? parent->version : 0;
+
+    // Bitwise compare, a handful of wide loads per field.
+    bool unchanged = parent == cachedParent && currentParentVersion == parentVersion
+        && memcmp(&localPosition, &cachedLocalPosition, sizeof(Vec3)) == 0
+        && memcmp(&localScale, &cachedLocalScale, sizeof(Vec3)) == 0
+        && memcmp(&localRotation, &cachedLocalRotation, sizeof(Matrix3x3)) == 0;
+    if (unchanged) {
+        return;
+    }
+
+    cachedParent = parent;
+    parentVersion = currentParentVersion;
+    cachedLocalPosition = localPosition;
+    cachedLocalScale = localScale;
+    cachedLocalRotation = localRotation;
+    cached = 0;
+    version++;
+    OnMoved();
+}
+
+void Transform::UseQuaternion(bool enable)
+{
+    if (enable && !useQuaternion)
+    {
+        localQuaternion = Quaternion::FromMatrix(localRotation);
+        cachedLocalQuaternion = localQuaternion;
+    }
+    useQuaternion = enable;
+}
+
+// Brings localRotation and localQuaternion back in agreement. The quaternion wins if it was written since the last sync,
+// otherwise a direct write to localRotation (SetParent, physics, input) is carried over to the quaternion.
+void Transform::SyncQuaternion()
+{
+    if (memcmp(&localQuaternion, &cachedLocalQuaternion, sizeof(Quaternion)) != 0)
+    {
+        localQuaternion.Normalize();
+        localRotation = localQuaternion.ToMatrix();
+    }
+    else if (memcmp(&localRotation, &cachedLocalRotation, sizeof(Matrix3x3)) != 0)
+    {
+        localQuaternion = Quaternion::FromMatrix(localRotation);
+    }
+    else {
+        return;
+    }
+    cachedLocalQuaternion = localQuaternion;
+}
+
 Matrix3x3 Transform::Rotation()
 {
+    if (useQuaternion && !parent) {
+        ValidateLocal();
+    }
     if (parent) {//TRS already checks for parent but checks again here because cheaper to return local position than creating the matrix
-        return ExtractRotation(TRS());
+        Validate();
+        if (!(cached & ROTATION_CACHED))
+        {
+            if (!(cached & SCALE_CACHED)) {
+                worldScale = ExtractScale(CachedTRS());
+                cached |= SCALE_CACHED;
+            }
+            worldRotation = ExtractRotation(CachedTRS(), &worldScale);
+            cached |= ROTATION_CACHED;
+        }
+        return worldRotation;
     }
     return localRotation;
 }
@@ -786,7 +1443,8 @@ Matrix3x3 Transform::Rotation()
 Vec3 Transform::Position()
 {
     if (parent) {//TRS already checks for parent but checks again here because cheaper to return local position than creating the matrix
-        return ExtractPosition(TRS());
+        Validate();
+        return ExtractPosition(CachedTRS());
     }
 
     return localPosition;
@@ -795,14 +1453,19 @@ Vec3 Transform::Position()
 Vec3 Transform::Scale()
 {
     if (parent) {
-        return ExtractScale(TRS());
+        Validate();
+        if (!(cached & SCALE_CACHED)) {
+            worldScale = ExtractScale(CachedTRS());
+            cached |= SCALE_CACHED;
+        }
+        return worldScale;
     }
     return localScale;
 }
 
 void Transform::SetParent(Transform* newParent, bool changeOfBasisTransition)
 {
-    static Matrix4x4 T;
+    static Matrix3x4 T;
     if (newParent == nullptr)
     {
         if (changeOfBasisTransition)
@@ -824,11 +1487,15 @@ void Transform::SetParent(Transform* newParent, bool changeOfBasisTransition)
             this->localPosition = Vec3(T.m[0][3], T.m[1][3], T.m[2][3]);
         }
 
-        this->parent = NULL;
-        this->root = this;
+        Attach(nullptr);
     }
     else if (newParent != this)
     {
+        // Parenting to one of our own descendants would make a loop
+        if (IsAncestorOf(newParent)) {
+            return;
+        }
+
         if (changeOfBasisTransition)
         {
             // If you immediatley parent a transform, everything is calculated relative to its immediate parent's reference frame. 
@@ -847,11 +1514,77 @@ void Transform::SetParent(Transform* newParent, bool changeOfBasisTransition)
             
         }
 
-        this->parent = newParent;
-        this->root = newParent->root;
+        Attach(newParent);
+    }
+}
+
+// Moves this transform (and its subtree) under newParent in the hierarchy. No change of basis.
+void Transform::Attach(Transform* newParent)
+{
+    if (this->parent)
+    {
+        List<Transform*>& siblings = this->parent->children;
+        auto it = std::find(siblings.begin(), siblings.end(), this);
+        if (it != siblings.end())
+        {
+            *it = siblings.back();
+            siblings.pop_back();
+        }
+    }
+
+    this->parent = newParent;
+    if (newParent) {
+        newParent->children.push_back(this);
+    }
+    UpdateSubtree();
+}
+
+// Re-derives root and depth from the parent, moving between hierarchy levels as needed, then does the same for all descendants.
+void Transform::UpdateSubtree()
+{
+    this->root = this->parent ? this->parent->root : this;
+    int newDepth = this->parent ? this->parent->depth + 1 : 0;
+    if (newDepth != this->depth)
+    {
+        TransformHierarchy::Unregister(this);
+        this->depth = newDepth;
+        TransformHierarchy::Register(this);
+    }
+
+    for (size_t i = 0; i < children.size(); i++) {
+        children[i]->UpdateSubtree();
+    }
+}
+
+bool Transform::IsAncestorOf(Transform* transform)
+{
+    for (Transform* ancestor = transform ? transform->parent : nullptr; ancestor; ancestor = ancestor->parent) {
+        if (ancestor == this) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Transform::Register()
+{
+    TransformHierarchy::Register(this);
+}
+
+Transform::~Transform()
+{
+    // Children keep their world pose and become roots
+    while (!children.empty()) {
+        children.back()->SetParent(nullptr);
     }
+    if (this->parent) {
+        Attach(nullptr);
+    }
+    TransformHierarchy::Unregister(this);
 }
 
+
+
 Matrix4x4 Transform::LocalScale4x4()
 {
     float matrix[4][4] =
@@ -880,6 +1613,9 @@ Matrix4x4 Transform::LocalScale4x4Inverse()
 
 Matrix4x4 Transform::LocalRotation4x4()
 {
+    if (useQuaternion) {
+        Validate();
+    }
     float matrix[4][4] =
     {
         {this->localRotation.m[0][0], this->localRotation.m[0][1], this->localRotation.m[0][2], 0},
@@ -918,61 +1654,189 @@ Matrix4x4 Transform::LocalTranslation4x4Inverse()
 }
 
 // 1:Scale, 2:Rotate, 3:Translate
-Matrix4x4 Transform::TRS()
+Matrix3x4 Transform::TRS()
 {
-    float trs[4][4] =
-    {
-        {this->localRotation.m[0][0] * localScale.x, this->localRotation.m[0][1] * localScale.y, this->localRotation.m[0][2] * localScale.z, localPosition.x},
-        {this->localRotation.m[1][0] * localScale.x, this->localRotation.m[1][1] * localScale.y, this->localRotation.m[1][2] * localScale.z, localPosition.y},
-        {this->localRotation.m[2][0] * localScale.x, this->localRotation.m[2][1] * localScale.y, this->localRotation.m[2][2] * localScale.z, localPosition.z},
-        {0,                                         0,                                  0,                      1}
-    };
-
-    if (parent) {
-        return parent->TRS() * trs;
-    }
-
-    return trs;
+    Validate();
+    return CachedTRS();
 }
 
 // S^-1 * R^-1 * T^-1
-Matrix4x4 Transform::TRSInverse()
+Matrix3x4 Transform::TRSInverse()
 {
-    if (parent) {
-        return LocalScale4x4Inverse() * Matrix4x4::Transpose(LocalRotation4x4()) * LocalTranslation4x4Inverse() * parent->TRSInverse();
-    }
-
-    return LocalScale4x4Inverse() * Matrix4x4::Transpose(LocalRotation4x4()) * LocalTranslation4x4Inverse();
+    Validate();
+    return CachedTRSInverse();
 }
 
 // 1:Rotate, 2:Translate
-Matrix4x4 Transform::TR()
+Matrix3x4 Transform::TR()
 {
-    float tr[4][4] =
-    {
-        {this->localRotation.m[0][0], this->localRotation.m[0][1], this->localRotation.m[0][2], localPosition.x},
-        {this->localRotation.m[1][0], this->localRotation.m[1][1], this->localRotation.m[1][2], localPosition.y},
-        {this->localRotation.m[2][0], this->localRotation.m[2][1], this->localRotation.m[2][2], localPosition.z},
-        {0,                                         0,                                  0,                      1}
-    };
-    if (parent) {
-        return parent->TR() * tr;
-    }
-
-    return tr;
+    Validate();
+    return CachedTR();
 }
 
 // R^-1 * T^-1
-Matrix4x4 Transform::TRInverse()
+Matrix3x4 Transform::TRInverse()
 {
-    if (parent) {
-        return  Matrix4x4::Transpose(LocalRotation4x4()) * LocalTranslation4x4Inverse() * parent->TRInverse();
-    }
-
-    return Matrix4x4::Transpose(LocalRotation4x4()) * LocalTranslation4x4Inverse();
+    Validate();
+    return CachedTRInverse();
 }
 
-//-----------------------------CAMERA-------------------------------------------------
+// The Cached* versions assume Validate() was already called on this transform (which validates the whole parent chain).
+const Matrix3x4& Transform::CachedTRS()
+{
+    if (!(cached & TRS_CACHED))
+    {
+        float trs[3][4] =
+        {
+            {this->localRotation.m[0][0] * localScale.x, this->localRotation.m[0][1] * localScale.y, this->localRotation.m[0][2] * localScale.z, localPosition.x},
+            {this->localRotation.m[1][0] * localScale.x, this->localRotation.m[1][1] * localScale.y, this->localRotation.m[1][2] * localScale.z, localPosition.y},
+            {this->localRotation.m[2][0] * localScale.x, this->localRotation.m[2][1] * localScale.y, this->localRotation.m[2][2] * localScale.z, localPosition.z}
+        };
+
+        if (parent) {
+            worldTRS = parent->CachedTRS() * Matrix3x4(trs);
+        }
+        else {
+            worldTRS = trs;
+        }
+        cached |= TRS_CACHED;
+    }
+
+    return worldTRS;
+}
+
+const Matrix3x4& Transform::CachedTRSInverse()
+{
+    if (!(cached & TRS_INVERSE_CACHED))
+    {
+        // Rows of R^T scaled by 1/s, translation is -(S^-1 * R^T) * p
+        float invScale[3] = { 1.0f / localScale.x, 1.0f / localScale.y, 1.0f / localScale.z };
+        float inverse[3][4];
+        for (int r = 0; r < 3; r++)
+        {
+            inverse[r][0] = this->localRotation.m[0][r] * invScale[r];
+            inverse[r][1] = this->localRotation.m[1][r] * invScale[r];
+            inverse[r][2] = this->localRotation.m[2][r] * invScale[r];
+            inverse[r][3] = -(inverse[r][0] * localPosition.x + inverse[r][1] * localPosition.y + inverse[r][2] * localPosition.z);
+        }
+
+        if (parent) {
+            worldTRSInverse = Matrix3x4(inverse) * parent->CachedTRSInverse();
+        }
+        else {
+            worldTRSInverse = inverse;
+        }
+        cached |= TRS_INVERSE_CACHED;
+    }
+
+    return worldTRSInverse;
+}
+
+const Matrix3x4& Transform::CachedTR()
+{
+    if (!(cached & TR_CACHED))
+    {
+        Matrix3x4 tr = Matrix3x4(localRotation, localPosition);
+        if (parent) {
+            worldTR = parent->CachedTR() * tr;
+        }
+        else {
+            worldTR = tr;
+        }
+        cached |= TR_CACHED;
+    }
+
+    return worldTR;
+}
+
+const Matrix3x4& Transform::CachedTRInverse()
+{
+    if (!(cached & TR_INVERSE_CACHED))
+    {
+        // R^T, translation is -R^T * p
+        float inverse[3][4];
+        for (int r = 0; r < 3; r++)
+        {
+            inverse[r][0] = this->localRotation.m[0][r];
+            inverse[r][1] = this->localRotation.m[1][r];
+            inverse[r][2] = this->localRotation.m[2][r];
+            inverse[r][3] = -(inverse[r][0] * localPosition.x + inverse[r][1] * localPosition.y + inverse[r][2] * localPosition.z);
+        }
+
+        if (parent) {
+            worldTRInverse = Matrix3x4(inverse) * parent->CachedTRInverse();
+        }
+        else {
+            worldTRInverse = inverse;
+        }
+        cached |= TR_INVERSE_CACHED;
+    }
+
+    return worldTRInverse;
+}
+
+void TransformHierarchy::Register(Transform* transform)
+{
+    if (transform->depth >= (int)levels->size()) {
+        levels->resize(transform->depth + 1);
+    }
+    List<Transform*>& level = (*levels)[transform->depth];
+    transform->hierarchyIndex = (int)level.size();
+    level.push_back(transform);
+}
+
+void TransformHierarchy::Unregister(Transform* transform)
+{
+    if (transform->hierarchyIndex < 0) {
+        return;
+    }
+    // Swap with the last entry so removal stays O(1)
+    List<Transform*>& level = (*levels)[transform->depth];
+    Transform* last = level.back();
+    level[transform->hierarchyIndex] = last;
+    last->hierarchyIndex = transform->hierarchyIndex;
+    level.pop_back();
+    transform->hierarchyIndex = -1;
+}
+
+// Brings every world TRS up to date, one depth level at a time. Within a level transforms only read their
+// (already updated) parent, so a level can be split across threads. Lazy reads afterwards hit the cache.
+void TransformHierarchy::Update()
+{
+    if (!enabled) {
+        return;
+    }
+
+    for (size_t d = 0; d < levels->size(); d++)
+    {
+        List<Transform*>& level = (*levels)[d];
+        auto updateRange = [&level](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+            {
+                level[i]->ValidateLocal();
+                level[i]->CachedTRS();
+            }
+        };
+
+        if (level.size() >= (size_t)parallelThreshold) {
+            ThreadPool::Instance().ParallelFor(level.size(), grainSize, updateRange);
+        }
+        else {
+            updateRange(0, level.size());
+        }
+    }
+}
+
+size_t TransformHierarchy::Count()
+{
+    size_t count = 0;
+    for (size_t d = 0; d < levels->size(); d++) {
+        count += (*levels)[d].size();
+    }
+    return count;
+}
+
+//-----------------------------CAMERA-------------------------------------------------
 struct CameraSettings
 {
     static bool outsiderViewPerspective;
@@ -1009,6 +1873,7 @@ public:
     {
         cameras.emplace(cameras.begin() + cameraCount++, this);
         this->name = "Camera " + cameraCount;
+        UseQuaternion();
     }
     
     static bool InsideViewScreen(Vec3* verts_proj, int size)
@@ -1036,12 +1901,19 @@ Camera* Camera::main = camera1;
 
 bool Mesh::SetVisibility(bool visible)
 {
+    this->visible = visible;
     if (visible) {
         ManagedObjectPool<Mesh>::AddToPool(this);
+        QueueCulling();
         return true;
     }
     else {
         ManagedObjectPool<Mesh>::RemoveFromPool(this);
+        if (cullingItem >= 0)
+        {
+            cullingTree.Remove(cullingItem);
+            cullingItem = -1;
+        }
         return false;
     }
 }
@@ -1052,145 +1924,398 @@ void Mesh::SetColor(Color&& c) {
 void Mesh::SetColor(Color& c)
 {
     color = c;
-    if (vertices.size() > 0)
+    colorOverride = true;
+    delete triangleColors;
+    triangleColors = nullptr;
+}
+
+void Mesh::SetTriangleColor(const int& triangleIndex, const Color& c)
+{
+    if (!triangleColors)
     {
-        for (int i = 0; i < triangles->size(); i++)
-        {
-            (*triangles)[i].color = c;
+        triangleColors = new List<Color>(geometry->triangles.size());
+        for (size_t i = 0; i < triangleColors->size(); i++) {
+            (*triangleColors)[i] = GetTriangleColor((int)i);
         }
     }
+    (*triangleColors)[triangleIndex] = c;
+}
+
+Color Mesh::GetTriangleColor(const int& triangleIndex)
+{
+    if (triangleColors) {
+        return (*triangleColors)[triangleIndex];
+    }
+    return colorOverride ? color : geometry->triangles[triangleIndex].color;
+}
+
+void Mesh::SetGeometry(std::shared_ptr<MeshGeometry> geometry)
+{
+    this->geometry = geometry ? geometry : MeshGeometry::Empty();
+    delete triangleColors;
+    triangleColors = nullptr;
+    bounds->CreateBounds(this);
+    QueueCulling();
+}
+
+MeshGeometry& Mesh::UniqueGeometry()
+{
+    if (geometry.use_count() > 1)
+    {
+        geometry = std::make_shared<MeshGeometry>(*geometry);
+        geometry->name = "";
+        geometry->lods.clear();// Would no longer match the edited mesh
+    }
+    return *geometry;
 }
 
-List<Triangle>* Mesh::MapVertsToTriangles()
+void MeshGeometry::Build(bool calculateBounds)
 {
-    if (indices && !vertices.empty())
+    size_t count = indices.size() / 3;
+    triangles.resize(count);
+    triangleNormals.resize(count);
+    triangleCentroids.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        Vec3& p1 = vertices[indices[i * 3]];
+        Vec3& p2 = vertices[indices[i * 3 + 1]];
+        Vec3& p3 = vertices[indices[i * 3 + 2]];
+
+        triangles[i].verts[0] = p1;
+        triangles[i].verts[1] = p2;
+        triangles[i].verts[2] = p3;
+
+        // Same winding as Plane::Normal()
+        Vec3 normal = CrossProduct(p3 - p1, p2 - p1);
+        float length = normal.Magnitude();
+        triangleNormals[i] = length > 0 ? normal * (1.0f / length) : Vec3(0, 0, 0);
+        triangleCentroids[i] = Vec3((p1.x + p2.x + p3.x) / 3.0f, (p1.y + p2.y + p3.y) / 3.0f, (p1.z + p2.z + p3.z) / 3.0f);
+        triangles[i].normal = triangleNormals[i];
+        triangles[i].centroid = Vec4(triangleCentroids[i].x, triangleCentroids[i].y, triangleCentroids[i].z, triangles[i].centroid.w);
+    }
+
+    if (calculateBounds && !vertices.empty())
     {
-        int t = 0;
-        for (size_t i = 0; i < indices->size(); i++)
+        Range xRange = ProjectVertsOntoAxis(vertices.data(), vertices.size(), Direction::right);
+        Range yRange = ProjectVertsOntoAxis(vertices.data(), vertices.size(), Direction::up);
+        Range zRange = ProjectVertsOntoAxis(vertices.data(), vertices.size(), Direction::back);
+        min = Vec3(xRange.min, yRange.min, zRange.min);
+        max = Vec3(xRange.max, yRange.max, zRange.max);
+    }
+
+    BuildMeshlets();
+}
+
+void MeshGeometry::BuildMeshlets()
+{
+    meshlets.clear();
+    int count = (int)triangles.size();
+    for (int first = 0; first < count; first += meshletMaxTriangles)
+    {
+        int end = first + meshletMaxTriangles < count ? first + meshletMaxTriangles : count;
+        Vec3 normalSum = Vec3(0, 0, 0);
+        for (int t = first; t < end; t++) {
+            normalSum += triangleNormals[t];
+        }
+        Meshlet meshlet;
+        meshlet.firstTriangle = first;
+        meshlet.triangleCount = end - first;
+
+        // Sphere around the box of its corners
+        Vec3 boxMin = triangles[first].verts[0];
+        Vec3 boxMax = boxMin;
+        for (int t = first; t < end; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                Vec3& v = triangles[t].verts[k];
+                boxMin = Vec3(v.x < boxMin.x ? v.x : boxMin.x, v.y < boxMin.y ? v.y : boxMin.y, v.z < boxMin.z ? v.z : boxMin.z);
+                boxMax = Vec3(v.x > boxMax.x ? v.x : boxMax.x, v.y > boxMax.y ? v.y : boxMax.y, v.z > boxMax.z ? v.z : boxMax.z);
+            }
+        }
+        meshlet.center = (boxMin + boxMax) * 0.5;
+        float radiusSqr = 0;
+        for (int t = first; t < end; t++)
         {
-            int p1Index = (*indices)[i++];
-            int p2Index = (*indices)[i++];
-            int p3Index = (*indices)[i];
+            for (int k = 0; k < 3; k++)
+            {
+                float distanceSqr = (triangles[t].verts[k] - meshlet.center).SqrMagnitude();
+                radiusSqr = distanceSqr > radiusSqr ? distanceSqr : radiusSqr;
+            }
+        }
+        meshlet.radius = sqrt(radiusSqr);
 
-            (*triangles)[t].verts[0] = (vertices)[p1Index];
-            (*triangles)[t].verts[1] = (vertices)[p2Index];
-            (*triangles)[t].verts[2] = (vertices)[p3Index];
-            
-            t++;
+        // Degenerate triangles (zero normal) are culled one by one anyway, so they don't widen the cone
+        float length = normalSum.Magnitude();
+        meshlet.coneAxis = length > 0 ? normalSum * (1.0f / length) : Vec3(0, 0, 0);
+        float minDot = length > 0 ? 1.0f : -1.0f;
+        for (int t = first; t < end; t++)
+        {
+            Vec3& normal = triangleNormals[t];
+            if (normal.x != 0 || normal.y != 0 || normal.z != 0)
+            {
+                float d = DotProduct(meshlet.coneAxis, normal);
+                minDot = d < minDot ? d : minDot;
+            }
         }
+        meshlet.coneCutoff = minDot > 0 ? sqrt(1.0f - minDot * minDot) : 2.0f;
+        meshlets.emplace_back(meshlet);
     }
+}
 
-    return triangles;
+std::shared_ptr<MeshGeometry> MeshGeometry::Box(const Vec3& min, const Vec3& max)
+{
+    std::shared_ptr<MeshGeometry> box = std::make_shared<MeshGeometry>();
+    box->vertices = List<Vec3>({
+        //south
+        Vec3(min.x, min.y, max.z),
+        Vec3(min.x, max.y, max.z),
+        Vec3(max.x, max.y, max.z),
+        Vec3(max.x, min.y, max.z),
+        //north
+        Vec3(min.x, min.y, min.z),
+        Vec3(min.x, max.y, min.z),
+        Vec3(max.x, max.y, min.z),
+        Vec3(max.x, min.y, min.z)
+        });
+
+    box->indices = List<int>{
+        //South
+        0, 1, 2,
+        0, 2, 3,
+        //North
+        7, 6, 5,
+        7, 5, 4,
+        //Right
+        3, 2, 6,
+        3, 6, 7,
+        //Left
+        4, 5, 1,
+        4, 1, 0,
+        //Top
+        1, 5, 6,
+        1, 6, 2,
+        //Bottom
+        3, 7, 4,
+        3, 4, 0
+    };
+
+    box->Build();
+    return box;
 }
 
 //Convert to world coordinates
 List<Vec3> Mesh::WorldVertices()
 {
-    List<Vec3> verts = vertices;
-    Matrix4x4 matrix = TRS();
-    for (size_t i = 0; i < verts.size(); i++)
+    const List<Vec3>& vertices = geometry->vertices;
+    List<Vec3> verts = List<Vec3>(vertices.size());
+    TransformPoints(TRS(), vertices.data(), verts.data(), vertices.size());
+
+    return verts;
+}
+
+MeshGeometry& Mesh::SelectLOD(const ScreenSphere& sphere)
+{
+    MeshGeometry& full = *this->geometry;
+    List<std::shared_ptr<MeshGeometry>>& lods = full.lods;
+    // Per triangle colors are indexed by the full mesh's triangles
+    if (!Graphics::levelOfDetail || !Graphics::perspective || lods.empty() || triangleColors)
     {
-        verts[i] = (Vec3)(matrix * ((Vec4)verts[i]));
+        lodLevel = 0;
+        return full;
     }
 
-    return verts;
+    int level = 0;
+    for (int i = 0; i < (int)lods.size() && i < 3; i++)
+    {
+        float threshold = lodPixelSizes[i] * (lodLevel > i ? 1 + lodHysteresis : 1 - lodHysteresis);
+        if (sphere.pixels >= threshold) {
+            break;
+        }
+        level = i + 1;
+    }
+    lodLevel = level;
+    return level == 0 ? full : *lods[level - 1];
 }
 
 void Mesh::TransformTriangles()
 {
-    // Scale/Distance ratio culling
-    /* bool tooSmallToSee = scale.SqrMagnitude() / (position - Camera::main->position).SqrMagnitude() < 0.000000125;
-    if (tooSmallToSee) {
+    // Shared geometry, only read here. Distant meshes draw one of its simplified levels.
+    ScreenSphere sphere = BoundingSphere();
+    MeshGeometry& geometry = SelectLOD(sphere);
+    List<Vec3>& vertices = geometry.vertices;
+    List<int>& indices = geometry.indices;
+    List<Triangle>& triangles = geometry.triangles;
+    List<Vec3>& triangleNormals = geometry.triangleNormals;
+    List<Vec3>& triangleCentroids = geometry.triangleCentroids;
+    if (triangles.empty()) {
         return;
-    }*/
+    }
+
+    Matrix3x4 modelToWorldMatrix = this->TRS();
+    Matrix3x3 modelLinear = modelToWorldMatrix.Linear();
+    // Mirrored transforms flip the winding, and with it which side faces the camera
+    float handedness = Matrix3x3::Determinant(modelLinear) < 0 ? -1.0f : 1.0f;
+
+    // ------------ Back-face Culling (model space) ------------
+    // Checks if the triangles backside is facing the camera. The camera is brought into model space once so each
+    // triangle is a single dot product against its precomputed normal, before any of its vertices are transformed.
+    // Condition makes this setting optional when drawing wireframes alone, but will force culling if triangles are filled.
+    bool cullBackFaces = Graphics::backFaceCulling || Graphics::fillTriangles;
+    float facing = Graphics::invertNormals ? -handedness : handedness;
+    Vec3 cameraPosition_w = -(Matrix3x3::Transpose(worldToViewMatrix.Linear()) * worldToViewMatrix.Translation());
+    Vec3 cameraPosition_m = this->TRSInverse() * cameraPosition_w;
+
+    // Surviving triangles, and the vertices they use packed together so only those get transformed.
+    // Shared by all meshes since they're transformed one at a time. vertexStamp marks vertices used this call.
+    static List<int> visibleTriangles;
+    static List<Vec3> usedVerts;
+    static List<int> vertexSlot;
+    static List<unsigned int> vertexStamp;
+    static unsigned int stamp = 0;
+    visibleTriangles.clear();
+    int firstUsed = INT_MAX;
+    int lastUsed = -1;
+    if (vertexStamp.size() < vertices.size())
+    {
+        vertexStamp.resize(vertices.size(), 0);
+        vertexSlot.resize(vertices.size());
+    }
+    if (++stamp == 0)
+    {
+        std::fill(vertexStamp.begin(), vertexStamp.end(), 0);
+        stamp = 1;
+    }
+
+    // ------------ Meshlet Culling ------------
+    // Whole meshlets facing away (normal cone, model space) or outside the frustum (bounding sphere, view space) are
+    // dropped before any of their triangles are looked at. Both tests are conservative, every triangle they reject
+    // would also fail the per triangle tests below.
+    List<Meshlet>& meshlets = geometry.meshlets;
+    Matrix3x4 modelToViewMatrix = worldToViewMatrix * modelToWorldMatrix;
+    Frustum frustum = Frustum::FromProjection(projectionMatrix, nearClippingPlane, farClippingPlane);
+    bool cullMeshlets = Graphics::meshletCulling && !meshlets.empty();
+    size_t clusterCount = cullMeshlets ? meshlets.size() : 1;
+    Mesh::meshletCount += cullMeshlets ? (int)clusterCount : 0;
+
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        size_t first = 0;
+        size_t end = triangles.size();
+        if (cullMeshlets)
+        {
+            Meshlet& meshlet = meshlets[c];
+            if (cullBackFaces && ConeBackfacing(meshlet.center, meshlet.radius, meshlet.coneAxis * facing, meshlet.coneCutoff, cameraPosition_m))
+            {
+                Mesh::meshletCullCount++;
+                continue;
+            }
+            if (Graphics::frustumCulling && !frustum.SphereVisible(modelToViewMatrix * meshlet.center, meshlet.radius * sphere.scale))
+            {
+                Mesh::meshletCullCount++;
+                continue;
+            }
+            first = meshlet.firstTriangle;
+            end = first + meshlet.triangleCount;
+        }
 
-    Matrix4x4 modelToWorldMatrix = this->TRS();
+        for (size_t i = first; i < end; i++)
+        {
+            if (cullBackFaces)
+            {
+                Vec3 posRelativeToCam = triangleCentroids[i] - cameraPosition_m;
+                bool faceInvisibleToCamera = facing * DotProduct(posRelativeToCam, triangleNormals[i]) >= 0;
+                if (faceInvisibleToCamera) {
+                    continue;// Skip triangle if it's part of the other side of the mesh.
+                }
+            }
 
-    //Transform Triangles
-    List<Triangle>* tris = MapVertsToTriangles();
+            visibleTriangles.emplace_back((int)i);
+            for (size_t k = 0; k < 3; k++)
+            {
+                int v = indices[i * 3 + k];
+                vertexStamp[v] = stamp;
+                firstUsed = std::min(firstUsed, v);
+                lastUsed = std::max(lastUsed, v);
+            }
+        }
+    }
 
-    for (int i = 0; i < tris->size(); i++)
+    // Packs the marked vertices in vertex order, which follows the triangle order (MeshOptimizer). Every vertex in the
+    // range is written and only marked ones advance, so there's no "seen before?" branch per corner: in vertex cache
+    // order new and reused corners alternate irregularly and that branch mispredicted about once per triangle.
+    size_t usedCount = 0;
+    if (usedVerts.size() < vertices.size()) {
+        usedVerts.resize(vertices.size());
+    }
+    for (int v = firstUsed; v <= lastUsed; v++)
     {
-        Triangle tri = (*tris)[i];
-        tri.mesh = this;
-        Triangle worldSpaceTri = tri;
-        Triangle camSpaceTri = tri;
-        Triangle projectedTri = tri;
-        for (int j = 0; j < 3; j++)
-        {
-            // Homogeneous coords (x, y, z, w=1)
-            Vec4 vert = tri.verts[j];
-
-            // =================== WORLD SPACE ===================
-            // Transform local coords to world-space coords.
-            Vec4 worldPoint = modelToWorldMatrix * vert;
-            worldSpaceTri.verts[j] = worldPoint;
-
-            // ================ VIEW/CAM/EYE SPACE ================
-            // Transform world coordinates to view coordinates.
-            Vec4 cameraSpacePoint = worldToViewMatrix * worldPoint;
-            camSpaceTri.verts[j] = cameraSpacePoint;
-
-            // ================ SCREEN SPACE ==================
-            // Project to screen space (image space)
-            Vec4 projectedPoint = projectionMatrix * cameraSpacePoint;
-            projectedTri.verts[j] = projectedPoint;
-        };
+        usedVerts[usedCount] = vertices[v];
+        vertexSlot[v] = (int)usedCount;
+        usedCount += vertexStamp[v] == stamp;
+    }
+
+    // Post-transform buffers. Every used vertex goes through model-view and projection once, then triangles
+    // are assembled from the indices (a closed mesh shares each vertex between ~6 triangles).
+    static List<Vec3> viewVerts;
+    static List<Vec4> projectedVerts;
+    viewVerts.resize(usedCount);
+    projectedVerts.resize(usedCount);
+
+    TransformPoints(modelToViewMatrix, usedVerts.data(), viewVerts.data(), usedCount);
+    ProjectPoints(projectionMatrix, viewVerts.data(), projectedVerts.data(), usedCount);
+
+    // Model space normals to world space for lighting: inverse transpose of the model matrix, flipped if it mirrors.
+    Matrix3x3 normalMatrix = Matrix3x3::Transpose(this->TRSInverse().Linear());
+
+    for (size_t t = 0; t < visibleTriangles.size(); t++)
+    {
+        int i = visibleTriangles[t];
+        int p1Slot = vertexSlot[indices[i * 3]];
+        int p2Slot = vertexSlot[indices[i * 3 + 1]];
+        int p3Slot = vertexSlot[indices[i * 3 + 2]];
 
-        //------------------- Normal/Frustum Culling (view space)------------------------
-        Vec3 p1_c = camSpaceTri.verts[0];
-        Vec3 p2_c = camSpaceTri.verts[1];
-        Vec3 p3_c = camSpaceTri.verts[2];
-        camSpaceTri.Centroid();
+        // Only the corners, color and depth key go on to the TriangleBuffer, no Triangle is built for them
+        Color triangleColor = triangles[i].color;
+        if (triangleColors) {
+            triangleColor = (*triangleColors)[i];
+        }
+        else if (colorOverride) {
+            triangleColor = color;
+        }
+        Vec3 projected[3] = { projectedVerts[p1Slot], projectedVerts[p2Slot], projectedVerts[p3Slot] };
+
+        //------------------- Frustum Culling (view space)------------------------
+        Vec3 p1_c = viewVerts[p1Slot];
+        Vec3 p2_c = viewVerts[p2Slot];
+        Vec3 p3_c = viewVerts[p3Slot];
+        Vec4 centroid_c = Vec4((p1_c.x + p2_c.x + p3_c.x) / 3.0f, (p1_c.y + p2_c.y + p3_c.y) / 3.0f, (p1_c.z + p2_c.z + p3_c.z) / 3.0f, 1);
 
         if (Graphics::frustumCulling)
         {
-            bool tooCloseToCamera = (p1_c.z >= nearClippingPlane || p2_c.z >= nearClippingPlane || p3_c.z >= nearClippingPlane || camSpaceTri.centroid.z >= nearClippingPlane);
+            bool tooCloseToCamera = (p1_c.z >= nearClippingPlane || p2_c.z >= nearClippingPlane || p3_c.z >= nearClippingPlane || centroid_c.z >= nearClippingPlane);
             if (tooCloseToCamera) {
                 continue;
             }
 
-            bool tooFarFromCamera = (p1_c.z <= farClippingPlane || p2_c.z <= farClippingPlane || p3_c.z <= farClippingPlane || camSpaceTri.centroid.z <= farClippingPlane);
+            bool tooFarFromCamera = (p1_c.z <= farClippingPlane || p2_c.z <= farClippingPlane || p3_c.z <= farClippingPlane || centroid_c.z <= farClippingPlane);
             if (tooFarFromCamera) {
                 continue;
             }
-            /*
-            bool behindCamera = DotProduct((Vec3)camSpaceTri.centroid, Direction::forward) <= 0.0;
-            if (behindCamera) {
-                continue; // Skip triangle if it's out of cam view.
-            }*/
-            if (!Camera::InsideViewScreen(projectedTri.verts, 3)) {
+            if (!Camera::InsideViewScreen(projected, 3)) {
                 continue;
             }
         }
 
-        // Calculate triangle suface Normal
-        camSpaceTri.Normal();//camSpaceTri.normal = worldToViewMatrix * modelToWorldMatrix * Vec4(camSpaceTri.normal, 0);
-
-        if (Graphics::invertNormals) {
-            camSpaceTri.normal = ((Vec3)camSpaceTri.normal) * -1.0f;
-        }
-
-        // Back-face Culling - Checks if the triangles backside is facing the camera.
-        // Condition makes this setting optional when drawing wireframes alone, but will force culling if triangles are filled.
-        if (Graphics::backFaceCulling || Graphics::fillTriangles)
-        {
-            Vec3 posRelativeToCam = camSpaceTri.centroid;// Since camera is (0,0,0) in view space, the displacement vector from camera to centroid IS the centroid itself.
-            bool faceInvisibleToCamera = DotProduct(posRelativeToCam, (Vec3)camSpaceTri.normal) >= 0;
-            if (faceInvisibleToCamera) {
-                continue;// Skip triangle if it's out of cam view or it's part of the other side of the mesh.
-            }
-        }
-
         //------------------------ Lighting (world space)------------------------
 
         if (Graphics::lighting && Graphics::fillTriangles)
         {
             if (!ignoreLighting)
             {
-                float amountFacingLight = DotProduct((Vec3)worldSpaceTri.Normal(), lightSource);
-                Color colorLit = projectedTri.color * Clamp(amountFacingLight, 0.15, 1);
-                projectedTri.color = colorLit;
+                Vec3 worldNormal = (normalMatrix * triangleNormals[i]) * handedness;
+                float amountFacingLight = DotProduct(worldNormal.Normalized(), lightSource);
+                triangleColor = triangleColor * Clamp(amountFacingLight, 0.15, 1);
             }
         }
 
@@ -1198,19 +2323,23 @@ void Mesh::TransformTriangles()
         {
             Vec3 screenLeftSide = Vec3(-1, 0, 0);
             Vec3 screenRightSide = Vec3(1, 0, 0);
-            Range range = ProjectVertsOntoAxis(projectedTri.verts, 3, screenRightSide);
+            Range range = ProjectVertsOntoAxis(projected, 3, screenRightSide);
             bool leftHalfScreenX = range.min > 0 && range.max > 0;
 
             if (leftHalfScreenX) {
-                projectedTri.color = Color(0, 0, 255);// std::cout << "Inside" << std::endl;
+                triangleColor = Color(0, 0, 255);// std::cout << "Inside" << std::endl;
             }
             else {
-                projectedTri.color = Color::red;
+                triangleColor = Color::red;
             }
         }
         // ---------- Debugging -----------
         if (Graphics::debugNormals)
         {
+            Triangle camSpaceTri = Triangle(p1_c, p2_c, p3_c);
+            if (Graphics::invertNormals) {
+                camSpaceTri.normal = ((Vec3)camSpaceTri.normal) * -1.0f;
+            }
             //---------Draw point at centroid and a line from centroid to normal (view space & projected space)-----------
             float normalScalar = (0.011f * ((Vec3)camSpaceTri.centroid).Magnitude());//Scaled depending on distance from camera
             Vec2 centroidToNormal_p = projectionMatrix * ((Vec3)camSpaceTri.centroid + camSpaceTri.normal * normalScalar);
@@ -1219,7 +2348,7 @@ void Mesh::TransformTriangles()
             Line::AddLine(Line(centroid_p, centroidToNormal_p));
         }
 
-        projectedTri.centroid = projectionMatrix * camSpaceTri.centroid;
+        float depthKey = (projectionMatrix * centroid_c).w;
 
         // Nested Projection or Double Projection
         if (CameraSettings::outsiderViewPerspective)
@@ -1228,17 +2357,196 @@ void Mesh::TransformTriangles()
 
             for (size_t k = 0; k < 3; k++)
             {
-                projectedTri.verts[k] = nestedProjectionMatrix * projectedTri.verts[k];
+                projected[k] = nestedProjectionMatrix * projected[k];
             }
         }
 
+        // Depth for the software z-buffer in place of the projected z, which perspective makes constant
+        float viewZ[3] = { p1_c.z, p2_c.z, p3_c.z };
+        for (size_t k = 0; k < 3; k++)
+        {
+            projected[k].z = Graphics::perspective ? (viewZ[k] < 0 ? -1.0f / viewZ[k] : 0.0f) : viewZ[k];
+        }
+
         //Add projected tri
-        triBuffer->emplace_back(projectedTri);
+        uint8_t flags = triangles[i].forceWireFrame || forceWireFrame ? TriangleBuffer::wireFrame : 0;
+        triBuffer->Add(projected[0], projected[1], projected[2], depthKey, triangleColor, flags);
+    }
+}
+bool Mesh::ScreenBounds(Vec2& min, Vec2& max, float& nearest)
+{
+    if (!bounds) {
+        return false;
+    }
+    Matrix3x4 modelToViewMatrix = worldToViewMatrix * this->TRS();
+    Vec3 corners[8];
+    Vec4 projected[8];
+    // The corners CreateBounds() already built, a Cube here would register a Transform per mesh per frame
+    TransformPoints(modelToViewMatrix, bounds->bounds.vertices.data(), corners, 8);
+    nearest = FLT_MAX;
+    for (int i = 0; i < 8; i++)
+    {
+        if (corners[i].z >= nearClippingPlane) {
+            return false;
+        }
+        nearest = std::min(nearest, -corners[i].z);
+    }
+    ProjectPoints(projectionMatrix, corners, projected, 8);
+    min = Vec2(projected[0].x, projected[0].y);
+    max = min;
+    for (int i = 1; i < 8; i++)
+    {
+        min = Vec2(std::min(min.x, projected[i].x), std::min(min.y, projected[i].y));
+        max = Vec2(std::max(max.x, projected[i].x), std::max(max.y, projected[i].y));
+    }
+    return true;
+}
+
+ScreenSphere Mesh::BoundingSphere()
+{
+    Matrix3x4 modelToWorldMatrix = this->TRS();
+    Matrix3x3 linear = modelToWorldMatrix.Linear();
+    float maxScaleSqr = 0;
+    for (int c = 0; c < 3; c++)
+    {
+        float scaleSqr = linear.m[0][c] * linear.m[0][c] + linear.m[1][c] * linear.m[1][c] + linear.m[2][c] * linear.m[2][c];
+        maxScaleSqr = scaleSqr > maxScaleSqr ? scaleSqr : maxScaleSqr;
+    }
+    Vec3 min = geometry->min;
+    Vec3 max = geometry->max;
+    ScreenSphere sphere;
+    sphere.scale = sqrt(maxScaleSqr);
+    sphere.center = modelToWorldMatrix * ((min + max) * 0.5);
+    sphere.radius = (max - min).Magnitude() * 0.5 * sphere.scale;
+
+    // projectionMatrix.m[1][1] scales view space height to -1..1, which spans screenHeight / 2 pixels per unit
+    float diameter = sphere.radius * projectionMatrix.m[1][1] * screenHeight;
+    if (!Graphics::perspective) {
+        sphere.pixels = diameter;
+        return sphere;
+    }
+    float depth = -(worldToViewMatrix * sphere.center).z;
+    sphere.pixels = depth > sphere.radius ? diameter / depth : FLT_MAX;
+    return sphere;
+}
+
+void Mesh::QueueCulling()
+{
+    if (cullingQueued) {
+        return;
     }
+    std::lock_guard<std::mutex> lock(cullingQueueMutex);
+    cullingQueued = true;
+    cullingQueue.emplace_back(this);
 }
+
+void Mesh::SyncCulling()
+{
+    if (!TransformHierarchy::enabled)
+    {
+        for (int i = 0; i < Mesh::count; i++) {
+            Mesh::objects[i]->Version();
+        }
+    }
+    // Indexed, reading a mesh's TRS() can validate (and queue) a parent
+    for (size_t i = 0; i < cullingQueue.size(); i++)
+    {
+        Mesh* mesh = cullingQueue[i];
+        if (mesh->visible)
+        {
+            Vec3 center = Vec3(0, 0, 0);
+            Vec3 extent = Vec3(FLT_MAX, FLT_MAX, FLT_MAX);// Never culled without bounds
+            if (mesh->bounds) {
+                TransformBox(mesh->TRS(), mesh->bounds->min, mesh->bounds->max, center, extent);
+            }
+            if (mesh->cullingItem < 0) {
+                mesh->cullingItem = cullingTree.Add(mesh, center, extent);
+            }
+            else {
+                cullingTree.Move(mesh->cullingItem, center, extent);
+            }
+        }
+        mesh->cullingQueued = false;
+    }
+    cullingQueue.clear();
+}
+
+void Mesh::RasterizeOccluder()
+{
+    // The level of detail drawn this frame, so what's hidden is hidden by what's on screen
+    MeshGeometry& geometry = SelectLOD();
+    List<Vec3>& vertices = geometry.vertices;
+    List<int>& indices = geometry.indices;
+    if (geometry.triangles.empty()) {
+        return;
+    }
+
+    // Same back-face test as TransformTriangles(), the back of an open mesh doesn't hide anything
+    Matrix3x4 modelToWorldMatrix = this->TRS();
+    float handedness = Matrix3x3::Determinant(modelToWorldMatrix.Linear()) < 0 ? -1.0f : 1.0f;
+    float facing = Graphics::invertNormals ? -handedness : handedness;
+    Vec3 cameraPosition_w = -(Matrix3x3::Transpose(worldToViewMatrix.Linear()) * worldToViewMatrix.Translation());
+    Vec3 cameraPosition_m = this->TRSInverse() * cameraPosition_w;
+
+    static List<Vec3> viewVerts;
+    static List<Vec4> projectedVerts;
+    viewVerts.resize(vertices.size());
+    projectedVerts.resize(vertices.size());
+    TransformPoints(worldToViewMatrix * modelToWorldMatrix, vertices.data(), viewVerts.data(), vertices.size());
+    ProjectPoints(projectionMatrix, viewVerts.data(), projectedVerts.data(), vertices.size());
+
+    // Meshlets facing away are skipped whole
+    List<Meshlet>& meshlets = geometry.meshlets;
+    size_t clusterCount = meshlets.empty() ? 1 : meshlets.size();
+    for (size_t c = 0; c < clusterCount; c++)
+    {
+        size_t first = 0;
+        size_t end = geometry.triangles.size();
+        if (!meshlets.empty())
+        {
+            Meshlet& meshlet = meshlets[c];
+            if (ConeBackfacing(meshlet.center, meshlet.radius, meshlet.coneAxis * facing, meshlet.coneCutoff, cameraPosition_m)) {
+                continue;
+            }
+            first = meshlet.firstTriangle;
+            end = first + meshlet.triangleCount;
+        }
+        for (size_t i = first; i < end; i++)
+        {
+            if (facing * DotProduct(geometry.triangleCentroids[i] - cameraPosition_m, geometry.triangleNormals[i]) >= 0) {
+                continue;
+            }
+            int v1 = indices[i * 3];
+            int v2 = indices[i * 3 + 1];
+            int v3 = indices[i * 3 + 2];
+            // Triangles reaching past the near plane are left out (they'd need clipping)
+            if (viewVerts[v1].z >= nearClippingPlane || viewVerts[v2].z >= nearClippingPlane || viewVerts[v3].z >= nearClippingPlane) {
+                continue;
+            }
+            OcclusionBuffer::AddTriangle(
+                projectedVerts[v1].x, projectedVerts[v1].y, -viewVerts[v1].z,
+                projectedVerts[v2].x, projectedVerts[v2].y, -viewVerts[v2].z,
+                projectedVerts[v3].x, projectedVerts[v3].y, -viewVerts[v3].z);
+        }
+    }
+}
+
 //List<Mesh*> Mesh::objects = List<Mesh*>(1000);
 //int Mesh::meshCount = 0;
 int Mesh::worldTriangleDrawCount = 0;
+float Mesh::lodPixelSizes[3] = { 400, 160, 60 };
+float Mesh::lodHysteresis = 0.15f;
+int Mesh::meshletCount = 0;
+int Mesh::meshletCullCount = 0;
+float Mesh::occluderScreenArea = 0.1f;
+int Mesh::maxOccluders = 8;
+int Mesh::occluderCount = 0;
+int Mesh::occlusionCullCount = 0;
+int Mesh::contributionCullCount = 0;
+int Mesh::contributionCullTriangleCount = 0;
+CullingTree<Mesh> Mesh::cullingTree;
+List<Mesh*> Mesh::cullingQueue;
+std::mutex Mesh::cullingQueueMutex;
 
 //------------------------------------CUBE MESH------------------------------------------
 class CubeMesh : public Mesh
@@ -1247,44 +2555,17 @@ public:
     CubeMesh(const float& scale = 1, const Vec3& position = Vec3(0, 0, 0), const Vec3& rotationEuler = Vec3(0, 0, 0))
         :Mesh(scale, position, rotationEuler)
     {
-        // Local Space (Object Space)
-        this->vertices = List<Vec3>({//new Vec3[8] {
-            //south
-            Vec3(-0.5, -0.5, 0.5),
-            Vec3(-0.5, 0.5, 0.5),
-            Vec3(0.5, 0.5, 0.5),
-            Vec3(0.5, -0.5, 0.5),
-            //north
-            Vec3(-0.5, -0.5, -0.5),
-            Vec3(-0.5, 0.5, -0.5),
-            Vec3(0.5, 0.5, -0.5),
-            Vec3(0.5, -0.5, -0.5)
-            });
-
-        this->indices = new List<int>{
-            //South
-            0, 1, 2,
-            0, 2, 3,
-            //North
-            7, 6, 5,
-            7, 5, 4,
-            //Right
-            3, 2, 6,
-            3, 6, 7,
-            //Left
-            4, 5, 1,
-            4, 1, 0,
-            //Top
-            1, 5, 6,
-            1, 6, 2,
-            //Bottom
-            3, 7, 4,
-            3, 4, 0
-        };
-
-        triangles = new List<Triangle>(this->indices->size() / 3);
+        static std::shared_ptr<MeshGeometry> cube = nullptr;
+        if (cube)
+        {
+            SetGeometry(cube);
+            return;
+        }
 
-        bounds->CreateBounds(this);
+        // Local Space (Object Space)
+        cube = MeshGeometry::Box(Vec3(-0.5, -0.5, -0.5), Vec3(0.5, 0.5, 0.5));
+        MeshGeometry::Register("CubeMesh", cube);
+        SetGeometry(cube);
     }
 };
 
@@ -1295,35 +2576,44 @@ public:
     PlaneMesh(const float& scale = 1, const Vec3& position = Vec3(0, 0, 0), const Vec3& rotationEuler = Vec3(0, 0, 0))
         :Mesh(scale, position, rotationEuler)
     {
-        this->vertices = List<Vec3>{
+        static std::shared_ptr<MeshGeometry> plane = nullptr;
+        if (plane)
+        {
+            SetGeometry(plane);
+            return;
+        }
+        plane = std::make_shared<MeshGeometry>();
+
+        plane->vertices = List<Vec3>{
                 Vec3(-0.5, 0, 0.5),
                 Vec3(-0.5, 0, -0.5),
                 Vec3(0.5, 0, -0.5),
                 Vec3(0.5, 0, 0.5)
         };
 
-        this->triangles->emplace_back(Triangle((vertices)[0], (vertices)[1], (vertices)[2]));
-        this->triangles->emplace_back(Triangle((vertices)[0], (vertices)[2], (vertices)[3]));
-        
-        bounds->CreateBounds(this);
+        plane->indices = List<int>{
+            0, 1, 2,
+            0, 2, 3
+        };
+
+        plane->Build();
+        MeshGeometry::Register("PlaneMesh", plane);
+        SetGeometry(plane);
     }
 };
 
 void BoundingBox::CreateBounds(Mesh* mesh)
 {
-    if (!mesh || mesh->vertices.size() < 1)
+    if (!mesh || mesh->Vertices().size() < 1)
     {
         return;
     }
 
     this->mesh = mesh;
 
-    Range xRange = ProjectVertsOntoAxis(mesh->vertices.data(), mesh->vertices.size(), Direction::right);
-    Range yRange = ProjectVertsOntoAxis(mesh->vertices.data(), mesh->vertices.size(), Direction::up);
-    Range zRange = ProjectVertsOntoAxis(mesh->vertices.data(), mesh->vertices.size(), Direction::back);
-
-    min = Vec3(xRange.min, yRange.min, zRange.min);
-    max = Vec3(xRange.max, yRange.max, zRange.max);
+    // Computed once per asset in MeshGeometry::Build()
+    min = mesh->Geometry().min;
+    max = mesh->Geometry().max;
     
     bounds = Cube(min, max);
 }
@@ -1337,11 +2627,7 @@ List<Vec3>* BoundingBox::WorldVertices()
 
     static List<Vec3> verts = List<Vec3>(8);
 
-    auto trs4x4 = mesh->TRS();
-    for (size_t i = 0; i < 8; i++)
-    {
-        verts[i] = trs4x4 * bounds.vertices[i];
-    }
+    TransformPoints(mesh->TRS(), bounds.vertices.data(), verts.data(), 8);
 
     return &verts;
 }
@@ -1367,132 +2653,80 @@ void BoundingBox::Draw()
     }
 }
 
-//------------------------------HELPER FUNCTIONS------------------------------------------------
+#include <MeshLoader.h>
+#include <OctTree.h>
 
-Mesh* LoadMeshFromOBJFile(std::string objFileName)
+// Removes the meshes hidden behind this frame's occluders. The biggest meshes on screen (and those marked occluder)
+// are drawn into the OcclusionBuffer, then every mesh's bounds are tested against it.
+void CullOccluded(List<Mesh*>& meshes)
 {
-    static std::string filePath = "./Objects/";
-
-    std::string mtlFileName = "";
-    std::ifstream mtlFile;
+    int occlusionHeight = std::max(256 * screenHeight / screenWidth, 1);
+    if (OcclusionBuffer::width != 256 || OcclusionBuffer::height != occlusionHeight) {
+        OcclusionBuffer::Resize(256, occlusionHeight);
+    }
+    OcclusionBuffer::Clear();
 
-    // ----------- Read object file -------------
-    List<std::string> strings;
-    std::string line;
-    std::ifstream objFile;
-    objFile.open(filePath + objFileName);
-    if (objFile.is_open())
+    struct Candidate
     {
-        while (objFile) {
-            // 1st. Gets the next line.
-            // 2nd. Seperates each word from that line then stores each word into the std::strings array.
-            getline(objFile, line);
-            std::string word;
-            std::stringstream ss(line);
-            while (getline(ss, word, ' '))
-            {
-                if (word == "mtllib") {
-                    getline(ss, word, ' ');
-                    mtlFileName = word;
-                }
-                else {
-                    strings.emplace_back(word);
-                }
-            }
+        Mesh* mesh;
+        bool onScreen;// Bounds in front of the near plane
+        Vec2 min;
+        Vec2 max;
+        float nearest;
+        float area;
+    };
+    static List<Candidate> candidates;
+    static List<Candidate*> occluders;
+    candidates.resize(meshes.size());
+    occluders.clear();
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        Candidate& c = candidates[i];
+        c.mesh = meshes[i];
+        c.onScreen = c.mesh->ScreenBounds(c.min, c.max, c.nearest);
+        c.area = 0;
+        if (c.onScreen) {
+            c.area = (Clamp(c.max.x, -1, 1) - Clamp(c.min.x, -1, 1)) * (Clamp(c.max.y, -1, 1) - Clamp(c.min.y, -1, 1)) * 0.25f;
         }
-    }
-    objFile.close();
-
-    // -----------------Construct new mesh-------------------
-    
-    List<Vec3> verts = List<Vec3>();
-    List<int>* indices = new List<int>();
-    List<Triangle>* triangles = new List<Triangle>(indices->size() / 3);
-    Material material;
-    for (size_t i = 0; i < strings.size(); i++)
-    {
-        // v = vertex
-        // f = face
-        std::string objFileSubString = strings[i];
-
-        // if .obj encounters "usemtl" then the next string will be material id.
-        if (objFileSubString == "usemtl")
-        {
-            // Try opening Material file to see if it exists
-            mtlFile.open(filePath + mtlFileName);
-            // check if using material before looking for material key words
-            if (mtlFile.is_open())
-            {
-                std::string mtlID = strings[++i];
-                bool mtlIDFound = false;
-                //materials->emplace_back(Material(materialID));
-                // search .mtl for material properties under the the current materialID
-                while (!mtlIDFound && mtlFile)
-                {
-                    // 1st. Gets the next line.
-                    // 2nd. Seperates each word from that line then stores each word into the strings array.
-                    getline(mtlFile, line);
-                    std::string word;
-                    std::stringstream ss(line);
-                    while (!mtlIDFound && getline(ss, word, ' '))
-                    {
-                        if (word == "newmtl")
-                        {
-                            getline(ss, word, ' ');
-                            if (mtlID == word) {
-                                material.name = word;
-                            }
-                        }
-                        else if (mtlID == material.name && word == "Kd") {
-                            getline(ss, word, ' ');
-                            float r = stof(word);
-                            getline(ss, word, ' ');
-                            float g = stof(word);
-                            getline(ss, word, ' ');
-                            float b = stof(word);
-                            material.color = Color(255 * r, 255 * g, 255 * b);
-
-                            mtlIDFound = true;
-                        }
-                    }
-                }
-                mtlFile.close();
-            }
+        // Wireframes don't hide anything
+        if (c.mesh->forceWireFrame || c.mesh->IsLoading()) {
+            continue;
         }
-
-        else if (objFileSubString == "v") {
-            float x = stof(strings[++i]);
-            float y = stof(strings[++i]);
-            float z = stof(strings[++i]);
-            verts.emplace_back(Vec3(x, y, z));
+        if (c.mesh->occluder || c.area >= Mesh::occluderScreenArea) {
+            occluders.emplace_back(&c);
         }
-        //f means the next 3 strings will be the indices for mapping vertices
-        else if (objFileSubString == "f") {
-            int p3Index = stof(strings[++i]) - 1;
-            int p2Index = stof(strings[++i]) - 1;
-            int p1Index = stof(strings[++i]) - 1;
-
-            indices->emplace_back(p1Index);
-            indices->emplace_back(p2Index);
-            indices->emplace_back(p3Index);
-
-            Triangle tri = Triangle((verts)[p1Index], (verts)[p2Index], (verts)[p3Index]);
-            tri.color = material.color;
-            triangles->emplace_back(tri);
+    }
+    std::sort(occluders.begin(), occluders.end(), [](const Candidate* a, const Candidate* b) {
+        return a->mesh->occluder != b->mesh->occluder ? a->mesh->occluder : a->area > b->area;
+    });
+    Mesh::occluderCount = 0;
+    for (size_t i = 0; i < occluders.size(); i++)
+    {
+        if (!occluders[i]->mesh->occluder && Mesh::occluderCount >= Mesh::maxOccluders) {
+            break;
         }
+        occluders[i]->mesh->RasterizeOccluder();
+        Mesh::occluderCount++;
     }
-    //mtlFile.close();
-    Mesh* mesh = new Mesh();
-    mesh->vertices = verts;
-    mesh->indices = indices;
-    mesh->triangles = triangles;
-    mesh->bounds->CreateBounds(mesh);
+    if (Mesh::occluderCount == 0) {
+        return;
+    }
+    OcclusionBuffer::BuildHierarchy();
 
-    return mesh;
+    size_t kept = 0;
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        Candidate& c = candidates[i];
+        if (c.onScreen && OcclusionBuffer::RectOccluded(c.min.x, c.min.y, c.max.x, c.max.y, c.nearest))
+        {
+            Mesh::occlusionCullCount++;
+            continue;
+        }
+        meshes[kept++] = c.mesh;
+    }
+    meshes.resize(kept);
 }
 
-#include <OctTree.h>
-
 void Draw()
 {
     // Camera TRInverse = (TR)^-1 = R^-1*T^-1 = M = Mcw = World to Camera coords. 
@@ -1546,43 +2780,47 @@ void Draw()
     }
     */
     // ---------- Transform -----------
-    for (int i = 0; i < Mesh::count; i++)
+    Mesh::meshletCount = 0;
+    Mesh::meshletCullCount = 0;
+    Mesh::occlusionCullCount = 0;
+    Mesh::contributionCullCount = 0;
+    Mesh::contributionCullTriangleCount = 0;
+    static List<Mesh*> visibleMeshes;
+    visibleMeshes.clear();
+
+    // ---------- Frustum Culling (world space) -----------
+    // Meshes are kept in a loose octree of world boxes, re-placed only when they move. Whole regions outside or inside
+    // the frustum are rejected or accepted at once, only boxes in regions on its boundary are tested (Culling.h).
+    static List<Mesh*> meshesInView;
+    meshesInView.clear();
+    if (Graphics::frustumCulling)
+    {
+        Mesh::SyncCulling();
+        Frustum frustum = Frustum::FromViewProjection(projectionMatrix, worldToViewMatrix, nearClippingPlane, farClippingPlane);
+        Mesh::cullingTree.Cull(frustum, meshesInView);
+    }
+    else {
+        meshesInView.assign(Mesh::objects.begin(), Mesh::objects.end());
+    }
+
+    for (size_t v = 0; v < meshesInView.size(); v++)
     {
-        Mesh* mesh = Mesh::objects[i];
+        Mesh* mesh = meshesInView[v];
         BoundingBox* bounds = mesh->bounds;
 
         if (Graphics::frustumCulling)
         {
-            // Scale/Distance ratio culling
-            /*float sqrDist = (mesh->root->localPosition - Camera::main->Position()).SqrMagnitude();
-            if (sqrDist != 0.0)
-            {
-                bool meshTooSmallToSee = mesh->root->localScale.SqrMagnitude() / sqrDist < 0.0000000000001;
-                if (meshTooSmallToSee) {
-                    continue;
-                }
-            }*/
             /*
             bool meshBehindCamera = DotProduct((Mesh::objects[i]->Position() - Camera::main->position), Camera::main->Forward()) <= 0.0;
             if (meshBehindCamera) {
                 continue;
             }
 */
-            if (bounds)
+            if (bounds && Graphics::debugBounds)
             {
-                Matrix4x4 trs4x4 = vpMatrix * mesh->TRS();
-                Cube box = Cube(trs4x4 * bounds->min, trs4x4 * bounds->max);
-                if (!Camera::InsideViewScreen(box.vertices.data(), 8))
+                if (mesh != Camera::main->GetMesh() && DotProduct(mesh->Position() - Camera::main->Position(), Camera::main->Forward()) > 0)
                 {
-                    continue;
-                }
-                
-                if (Graphics::debugBounds)
-                {
-                    if (mesh != Camera::main->GetMesh() && DotProduct(mesh->Position() - Camera::main->Position(), Camera::main->Forward()) > 0)
-                    {
-                        bounds->Draw();
-                    }
+                    bounds->Draw();
                 }
             }
 
@@ -1609,15 +2847,47 @@ void Draw()
             
         }
 
-        mesh->TransformTriangles();
+        // ---------- Contribution Culling -----------
+        // Too small on screen to add anything but aliasing: skipped, or drawn as a single point
+        if (Graphics::contributionCulling)
+        {
+            ScreenSphere sphere = mesh->BoundingSphere();
+            if (sphere.pixels < Graphics::minScreenSize)
+            {
+                Mesh::contributionCullCount++;
+                Mesh::contributionCullTriangleCount += (int)mesh->SelectLOD(sphere).triangles.size();
+                if (Graphics::contributionImpostors) {
+                    Point::AddWorldPoint(Point(sphere.center, mesh->GetColor(), 1));
+                }
+                continue;
+            }
+        }
+
+        // Placeholder until the async load completes
+        if (mesh->IsLoading())
+        {
+            bounds->Draw();
+            continue;
+        }
+
+        visibleMeshes.emplace_back(mesh);
+    }
+
+    // ---------- Occlusion Culling -----------
+    // Only filled triangles hide what's behind them
+    Mesh::occluderCount = 0;
+    if (Graphics::occlusionCulling && Graphics::fillTriangles && !Graphics::displayWireFrames) {
+        CullOccluded(visibleMeshes);
+    }
+
+    for (size_t i = 0; i < visibleMeshes.size(); i++) {
+        visibleMeshes[i]->TransformTriangles();
     }
 
     Mesh::worldTriangleDrawCount = triBuffer->size();
 
     // ---------- Sort (Painter's algorithm) -----------
-    sort(triBuffer->begin(), triBuffer->end(), [](const Triangle& triA, const Triangle& triB) -> bool {
-        return triA.centroid.w > triB.centroid.w;
-        });
+    triBuffer->Sort();
     /*
     Matrix4x4 matrix = ProjectionMatrix() * Camera::main->TRInverse();
 
@@ -1734,10 +3004,7 @@ void Draw()
     //---------------------------------------------------------------------------------------------------*/
 
     // ---------- Draw -----------
-    for (int i = 0; i < triBuffer->size(); i++)
-    {
-        (*triBuffer)[i].Draw();
-    }
+    triBuffer->Draw();
 
     for (size_t i = 0; i < lineBuffer->size(); i++)
     {
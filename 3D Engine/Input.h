@@ -43,9 +43,9 @@ void OnMouseMoveEvent(GLFWwindow* window, double mouseX, double mouseY)
         double yAngle = numeric_limits<float>::epsilon() + rad * mouseSensitivity * -deltaMouseX;// * deltaTime; // 0.0000001 so no gimbal lock
         
         if (CameraSettings::outsiderViewPerspective) {
-            Camera::projector->localRotation *= YPR(xAngle, yAngle, 0);
+            Camera::projector->localQuaternion *= Quaternion::YPR(xAngle, yAngle, 0);
         } else {
-            Camera::main->localRotation *= YPR(xAngle, yAngle, 0);
+            Camera::main->localQuaternion *= Quaternion::YPR(xAngle, yAngle, 0);
         }
         //Camera::main->rotation = Matrix3x3::RotX(rotateSpeed * -deltaMouseY) * Camera::main->rotation * Matrix3x3::RotY((0.00001 + rotateSpeed) * -deltaMouseX);
     }
@@ -99,7 +99,7 @@ void OnMouseButtonEvent(GLFWwindow* window, int button, int action, int mods)
             {
                 info.objectHit->mesh->SetVisibility(true);
                 Vec3 scale = info.objectHit->Scale();
-                Matrix3x3 rot = ExtractRotation(info.objectHit->Parent().TRSInverse() * info.objectHit->LocalRotation4x4());
+                Matrix3x3 rot = ExtractRotation(info.objectHit->Parent().TRSInverse() * Matrix3x4(info.objectHit->LocalRotation4x4()));
                 Vec3 pos = info.objectHit->Position() + info.triangleHit_w.Normal() * scale.x;// *2.0;
                 
                 obj->localScale = scale;
@@ -126,10 +126,10 @@ void OnMouseButtonEvent(GLFWwindow* window, int button, int action, int mods)
                     Point::AddWorldPoint(Point(grabInfo.contactPoint, Color::green, 10));
                     grabbing = &grabInfo.objectHit->Root();//grabInfo.objectHit;
                     grabbingsOriginalParent = &grabbing->Parent();
-                    grabbingsOriginalTriColor = grabInfo.triangleHit->color;
+                    grabbingsOriginalTriColor = grabInfo.objectHit->GetTriangleColor(grabInfo.triangleIndex);
                     //grabInfo.objectHit->forceWireFrame = true;
                     //grabInfo.triangleHit->forceWireFrame = true;
-                    grabInfo.triangleHit->color = Color::green;
+                    grabInfo.objectHit->SetTriangleColor(grabInfo.triangleIndex, Color::green);
                     grabbing->SetParent(Camera::main);
                 }
             }
@@ -140,8 +140,7 @@ void OnMouseButtonEvent(GLFWwindow* window, int button, int action, int mods)
     {
         if (button == 1) {
             if (grabbing) {
-                grabInfo.triangleHit->forceWireFrame = false;
-                grabInfo.triangleHit->color = grabbingsOriginalTriColor;
+                grabInfo.objectHit->SetTriangleColor(grabInfo.triangleIndex, grabbingsOriginalTriColor);
                 grabbing->SetParent(grabbingsOriginalParent);
                 grabbing = NULL;
                 grabbingsOriginalParent = NULL;
@@ -165,7 +164,7 @@ void OnKeyPressEvent(GLFWwindow* window, int key, int scancode, int action, int
 
         // Reset Camera
         if (key == GLFW_KEY_0 || key == GLFW_KEY_BACKSPACE) {
-            Camera::main->localRotation = Matrix3x3::identity;
+            Camera::main->localQuaternion = Quaternion::identity;
             Camera::main->localPosition = Vec3();
             FOV(60);
         }
@@ -178,7 +177,7 @@ void OnKeyPressEvent(GLFWwindow* window, int key, int scancode, int action, int
         }
         else if (key == GLFW_KEY_F3) {
             CameraSettings::outsiderViewPerspective = !CameraSettings::outsiderViewPerspective;
-            Camera::projector->localRotation = Matrix3x3::identity;
+            Camera::projector->localQuaternion = Quaternion::identity;
             Camera::projector->localPosition = Vec3();
         }
 
@@ -229,13 +228,13 @@ void OnKeyPressEvent(GLFWwindow* window, int key, int scancode, int action, int
         }
         else if (glfwGetKey(window, GLFW_KEY_7) == GLFW_PRESS) {
             spawn = []() {
-                auto obj = new PhysicsObject(LoadMeshFromOBJFile("Diamond.obj"), new BoxCollider(false));
+                auto obj = new PhysicsObject(LoadMeshFromOBJFileAsync("Diamond.obj"), new BoxCollider(false));
                 obj->localScale *= 0.1;
                 return obj;
                 };
         }
         else if (glfwGetKey(window, GLFW_KEY_8) == GLFW_PRESS) {
-            Mesh* mesh = LoadMeshFromOBJFile("Icosahedron.obj");
+            Mesh* mesh = LoadMeshFromOBJFileAsync("Icosahedron.obj");
             mesh->localPosition = Camera::main->Position() + (Camera::main->Forward() * 10);
             mesh->localRotation = Camera::main->Rotation();
             mesh->localScale *= 0.1;
@@ -335,6 +334,9 @@ void OnKeyPressEvent(GLFWwindow* window, int key, int scancode, int action, int
         {
             Graphics::matrixMode = !Graphics::matrixMode;
         }
+        else if (key == GLFW_KEY_K) {
+            Graphics::levelOfDetail = !Graphics::levelOfDetail;
+        }
         else if (key == GLFW_KEY_B)
         {
             Graphics::debugBounds = !Graphics::debugBounds;
@@ -387,54 +389,54 @@ static void CameraControl(Camera* cam)
     //----------Camera Controls-------
     // FORWARD
     if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) {
-        moveDir += cam->localRotation * Direction::forward;
+        moveDir += cam->localQuaternion * Direction::forward;
     }
     // BACK
     if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) {
-        moveDir += cam->localRotation* Direction::back;
+        moveDir += cam->localQuaternion * Direction::back;
     }
     // LEFT
     if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) {
-        moveDir += cam->localRotation * Direction::left;
+        moveDir += cam->localQuaternion * Direction::left;
     }
     // RIGHT
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) {
-        moveDir += cam->localRotation * Direction::right;
+        moveDir += cam->localQuaternion * Direction::right;
     }
     // UP
     if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS) {
-        moveDir += cam->localRotation * Direction::up;
+        moveDir += cam->localQuaternion * Direction::up;
     }
     // DOWN
     if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
-        moveDir += cam->localRotation* Direction::down;
+        moveDir += cam->localQuaternion * Direction::down;
     }
 
     moveDir.Normalize();
 
     // ROTATE CCW
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS) {
-        cam->localRotation *= Matrix3x3::RotZ(rotateSpeed * deltaTime);
+        cam->localQuaternion *= Quaternion::RotZ(rotateSpeed * deltaTime);
     }
     // ROTATE CW
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS) {
-        cam->localRotation *= Matrix3x3::RotZ(-rotateSpeed * deltaTime);
+        cam->localQuaternion *= Quaternion::RotZ(-rotateSpeed * deltaTime);
     }
     // LOOK UP
     if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-        cam->localRotation *= Matrix3x3::RotX(rotateSpeed * deltaTime);
+        cam->localQuaternion *= Quaternion::RotX(rotateSpeed * deltaTime);
     }
     // LOOK DOWN
     if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-        cam->localRotation *= Matrix3x3::RotX(-rotateSpeed * deltaTime);
+        cam->localQuaternion *= Quaternion::RotX(-rotateSpeed * deltaTime);
     }
     // TURN LEFT
     if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-        cam->localRotation *= Matrix3x3::RotY(rotateSpeed * deltaTime);
+        cam->localQuaternion *= Quaternion::RotY(rotateSpeed * deltaTime);
     }
     // TURN RIGHT
     if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-        cam->localRotation *= Matrix3x3::RotY(-rotateSpeed * deltaTime);
+        cam->localQuaternion *= Quaternion::RotY(-rotateSpeed * deltaTime);
     }
     // Speed 
     if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
@@ -3,6 +3,20 @@
 #define MATRIX_H
 #include <Vector.h>
 #include <math.h>
+
+// SIMD kernels are picked at compile time (SSE on any x86-64 build, AVX when compiled with /arch:AVX or -mavx).
+// Define MATRIX_NO_SIMD to force the scalar fallback.
+#if !defined(MATRIX_NO_SIMD)
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MATRIX_SSE
+#endif
+#if defined(MATRIX_SSE) && defined(__AVX__)
+#define MATRIX_AVX
+#endif
+#endif
+#if defined(MATRIX_SSE)
+#include <immintrin.h>
+#endif
 /*
     This matrix library can be used for calculating rotation matrices used in 3-dimensional coordinate space.
 
@@ -15,6 +29,8 @@
     - Extracting colums and rows follow the pattern: Matrix[row][column].
     - Matrix multiplication A*B or Multiply(A, B) assumes A is the row matrix while B is the column matrix.
     - The *= operator can be used like so: A *= B, means A = A*B, where B is the column matrix.
+    - Multiply() and Matrix4x4 * p use the SSE/AVX kernels when available. The *Scalar() versions are the reference
+      implementation and sum in the same order, so both paths agree within float rounding.
     EXAMPLES:
     --------------------------------------------------------------------------------------------------
     Z AXIS ROTATION:
@@ -72,8 +88,43 @@ public:
         return result;
     }
 
+    // Negative when the matrix mirrors (odd number of negative scales)
+    static float Determinant(const Matrix3x3& matrix)
+    {
+        const float(&m)[3][3] = matrix.m;
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+            - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+            + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
     // A*B
     static Matrix3x3 Multiply(const Matrix3x3& matrixA, const Matrix3x3& matrixB)
+    {
+#if defined(MATRIX_SSE)
+        // Rows are 3 floats wide, so the 4th lane of the first two loads picks up the next row's first element.
+        // It only ever lands in the 4th lane of the result, which gets overwritten by the next row store (or dropped for the last row).
+        __m128 b0 = _mm_loadu_ps(matrixB.m[0]);
+        __m128 b1 = _mm_loadu_ps(matrixB.m[1]);
+        __m128 b2 = _mm_setr_ps(matrixB.m[2][0], matrixB.m[2][1], matrixB.m[2][2], 0.0f);
+        __m128 rows[3];
+        for (size_t r = 0; r < 3; r++)
+        {
+            __m128 row = _mm_mul_ps(_mm_set1_ps(matrixA.m[r][0]), b0);
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(matrixA.m[r][1]), b1));
+            rows[r] = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(matrixA.m[r][2]), b2));
+        }
+        Matrix3x3 result;
+        _mm_storeu_ps(result.m[0], rows[0]);
+        _mm_storeu_ps(result.m[1], rows[1]);
+        _mm_storel_pi((__m64*)result.m[2], rows[2]);
+        _mm_store_ss(&result.m[2][2], _mm_movehl_ps(rows[2], rows[2]));
+        return result;
+#else
+        return MultiplyScalar(matrixA, matrixB);
+#endif
+    }
+
+    static Matrix3x3 MultiplyScalar(const Matrix3x3& matrixA, const Matrix3x3& matrixB)
     {
         Matrix3x3 result = Matrix3x3();
         for (size_t r = 0; r < 3; r++)
@@ -291,6 +342,29 @@ public:
 
     // A*B
     static Matrix4x4 Multiply(const Matrix4x4& matrixA, const Matrix4x4& matrixB)
+    {
+#if defined(MATRIX_SSE)
+        // One 128-bit row at a time, also under AVX: two-row 256-bit stores stalled chained products (TRS) on store forwarding.
+        __m128 b0 = _mm_loadu_ps(matrixB.m[0]);
+        __m128 b1 = _mm_loadu_ps(matrixB.m[1]);
+        __m128 b2 = _mm_loadu_ps(matrixB.m[2]);
+        __m128 b3 = _mm_loadu_ps(matrixB.m[3]);
+        Matrix4x4 result;
+        for (size_t r = 0; r < 4; r++)
+        {
+            __m128 a = _mm_loadu_ps(matrixA.m[r]);
+            // Summed pairwise to shorten the add chain
+            __m128 row01 = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, 0x00), b0), _mm_mul_ps(_mm_shuffle_ps(a, a, 0x55), b1));
+            __m128 row23 = _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(a, a, 0xAA), b2), _mm_mul_ps(_mm_shuffle_ps(a, a, 0xFF), b3));
+            _mm_storeu_ps(result.m[r], _mm_add_ps(row01, row23));
+        }
+        return result;
+#else
+        return MultiplyScalar(matrixA, matrixB);
+#endif
+    }
+
+    static Matrix4x4 MultiplyScalar(const Matrix4x4& matrixA, const Matrix4x4& matrixB)
     {
         Matrix4x4 result;
         for (size_t r = 0; r < 4; r++)
@@ -436,7 +510,7 @@ Matrix4x4 operator*(float matrixA[4][4], const Matrix4x4& matrixB)
     return Matrix4x4::Multiply(matrixA, matrixB);
 }
 // M * p
-Vector4<float> operator*(const Matrix4x4& matrix, const Vector4<float>& colVec)
+Vector4<float> MultiplyScalar(const Matrix4x4& matrix, const Vector4<float>& colVec)
 {
     Vector4<float> result = Vector4<float>();
     Vector4<float> row1 = Vector4<float>(matrix.m[0][0], matrix.m[0][1], matrix.m[0][2], matrix.m[0][3]);
@@ -458,6 +532,190 @@ Vector4<float> operator*(const Matrix4x4& matrix, const Vector4<float>& colVec)
     return result;
 }
 
+// M * p
+Vector4<float> operator*(const Matrix4x4& matrix, const Vector4<float>& colVec)
+{
+    // Kept scalar: an SSE transpose-and-add version measured no faster in BenchmarkMatrices.
+    return MultiplyScalar(matrix, colVec);
+}
+
+//-------------------Batch Transforms---------------------
+// Transform count points from src to dst (dst may be the same array as src).
+// The points are loaded 4 (SSE) or 8 (AVX) at a time, transposed into x, y, z lanes and transformed as structure-of-arrays.
+// Vector3 carries a 4th member (size), which rides along in the 4th lane and is written back untouched.
+static_assert(sizeof(Vector3<float>) == 4 * sizeof(float), "Batch transforms expect Vector3<float> to be 4 floats wide");
+static_assert(sizeof(Vector4<float>) == 4 * sizeof(float), "Batch transforms expect Vector4<float> to be 4 floats wide");
+
+#if defined(MATRIX_AVX)
+// In-lane transpose, two 4x4 blocks at once.
+inline void Transpose4x4(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+{
+    __m256 t0 = _mm256_shuffle_ps(r0, r1, 0x44);
+    __m256 t2 = _mm256_shuffle_ps(r0, r1, 0xEE);
+    __m256 t1 = _mm256_shuffle_ps(r2, r3, 0x44);
+    __m256 t3 = _mm256_shuffle_ps(r2, r3, 0xEE);
+    r0 = _mm256_shuffle_ps(t0, t1, 0x88);
+    r1 = _mm256_shuffle_ps(t0, t1, 0xDD);
+    r2 = _mm256_shuffle_ps(t2, t3, 0x88);
+    r3 = _mm256_shuffle_ps(t2, t3, 0xDD);
+}
+#endif
+
+// Affine: p' = M * p using the top 3 rows of M and no homogeneous divide (model, view and TRS matrices).
+void TransformPoints(const float m[][4], const Vector3<float>* src, Vector3<float>* dst, const size_t& count)
+{
+    size_t i = 0;
+#if defined(MATRIX_AVX)
+    __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]), m03 = _mm256_set1_ps(m[0][3]);
+    __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]), m13 = _mm256_set1_ps(m[1][3]);
+    __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]), m23 = _mm256_set1_ps(m[2][3]);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&src[i].x);
+        __m256 y = _mm256_loadu_ps(&src[i + 2].x);
+        __m256 z = _mm256_loadu_ps(&src[i + 4].x);
+        __m256 extra = _mm256_loadu_ps(&src[i + 6].x);
+        Transpose4x4(x, y, z, extra);
+
+        __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, x), _mm256_mul_ps(m01, y)), _mm256_mul_ps(m02, z)), m03);
+        __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, x), _mm256_mul_ps(m11, y)), _mm256_mul_ps(m12, z)), m13);
+        __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, x), _mm256_mul_ps(m21, y)), _mm256_mul_ps(m22, z)), m23);
+
+        Transpose4x4(rx, ry, rz, extra);
+        _mm256_storeu_ps(&dst[i].x, rx);
+        _mm256_storeu_ps(&dst[i + 2].x, ry);
+        _mm256_storeu_ps(&dst[i + 4].x, rz);
+        _mm256_storeu_ps(&dst[i + 6].x, extra);
+    }
+#endif
+#if defined(MATRIX_SSE)
+    __m128 n00 = _mm_set1_ps(m[0][0]), n01 = _mm_set1_ps(m[0][1]), n02 = _mm_set1_ps(m[0][2]), n03 = _mm_set1_ps(m[0][3]);
+    __m128 n10 = _mm_set1_ps(m[1][0]), n11 = _mm_set1_ps(m[1][1]), n12 = _mm_set1_ps(m[1][2]), n13 = _mm_set1_ps(m[1][3]);
+    __m128 n20 = _mm_set1_ps(m[2][0]), n21 = _mm_set1_ps(m[2][1]), n22 = _mm_set1_ps(m[2][2]), n23 = _mm_set1_ps(m[2][3]);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&src[i].x);
+        __m128 y = _mm_loadu_ps(&src[i + 1].x);
+        __m128 z = _mm_loadu_ps(&src[i + 2].x);
+        __m128 extra = _mm_loadu_ps(&src[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, extra);
+
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n00, x), _mm_mul_ps(n01, y)), _mm_mul_ps(n02, z)), n03);
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n10, x), _mm_mul_ps(n11, y)), _mm_mul_ps(n12, z)), n13);
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n20, x), _mm_mul_ps(n21, y)), _mm_mul_ps(n22, z)), n23);
+
+        _MM_TRANSPOSE4_PS(rx, ry, rz, extra);
+        _mm_storeu_ps(&dst[i].x, rx);
+        _mm_storeu_ps(&dst[i + 1].x, ry);
+        _mm_storeu_ps(&dst[i + 2].x, rz);
+        _mm_storeu_ps(&dst[i + 3].x, extra);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float x = src[i].x;
+        float y = src[i].y;
+        float z = src[i].z;
+        dst[i].x = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+        dst[i].y = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+        dst[i].z = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+        dst[i].size = src[i].size;
+    }
+}
+
+void TransformPoints(const Matrix4x4& matrix, const Vector3<float>* src, Vector3<float>* dst, const size_t& count)
+{
+    TransformPoints(matrix.m, src, dst, count);
+}
+
+// Projective: same as M * p for every point (w = 1 in, full 4x4, xyz divided by w when w != 0). w is kept in dst[i].w.
+void ProjectPoints(const Matrix4x4& matrix, const Vector3<float>* src, Vector4<float>* dst, const size_t& count)
+{
+    const float(&m)[4][4] = matrix.m;
+    size_t i = 0;
+#if defined(MATRIX_AVX)
+    __m256 zero8 = _mm256_setzero_ps();
+    __m256 m00 = _mm256_set1_ps(m[0][0]), m01 = _mm256_set1_ps(m[0][1]), m02 = _mm256_set1_ps(m[0][2]), m03 = _mm256_set1_ps(m[0][3]);
+    __m256 m10 = _mm256_set1_ps(m[1][0]), m11 = _mm256_set1_ps(m[1][1]), m12 = _mm256_set1_ps(m[1][2]), m13 = _mm256_set1_ps(m[1][3]);
+    __m256 m20 = _mm256_set1_ps(m[2][0]), m21 = _mm256_set1_ps(m[2][1]), m22 = _mm256_set1_ps(m[2][2]), m23 = _mm256_set1_ps(m[2][3]);
+    __m256 m30 = _mm256_set1_ps(m[3][0]), m31 = _mm256_set1_ps(m[3][1]), m32 = _mm256_set1_ps(m[3][2]), m33 = _mm256_set1_ps(m[3][3]);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&src[i].x);
+        __m256 y = _mm256_loadu_ps(&src[i + 2].x);
+        __m256 z = _mm256_loadu_ps(&src[i + 4].x);
+        __m256 w = _mm256_loadu_ps(&src[i + 6].x);
+        Transpose4x4(x, y, z, w);
+
+        __m256 rx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m00, x), _mm256_mul_ps(m01, y)), _mm256_mul_ps(m02, z)), m03);
+        __m256 ry = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m10, x), _mm256_mul_ps(m11, y)), _mm256_mul_ps(m12, z)), m13);
+        __m256 rz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m20, x), _mm256_mul_ps(m21, y)), _mm256_mul_ps(m22, z)), m23);
+        __m256 rw = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m30, x), _mm256_mul_ps(m31, y)), _mm256_mul_ps(m32, z)), m33);
+
+        __m256 divide = _mm256_cmp_ps(rw, zero8, _CMP_NEQ_UQ);
+        rx = _mm256_blendv_ps(rx, _mm256_div_ps(rx, rw), divide);
+        ry = _mm256_blendv_ps(ry, _mm256_div_ps(ry, rw), divide);
+        rz = _mm256_blendv_ps(rz, _mm256_div_ps(rz, rw), divide);
+
+        Transpose4x4(rx, ry, rz, rw);
+        _mm256_storeu_ps(&dst[i].x, rx);
+        _mm256_storeu_ps(&dst[i + 2].x, ry);
+        _mm256_storeu_ps(&dst[i + 4].x, rz);
+        _mm256_storeu_ps(&dst[i + 6].x, rw);
+    }
+#endif
+#if defined(MATRIX_SSE)
+    __m128 zero4 = _mm_setzero_ps();
+    __m128 n00 = _mm_set1_ps(m[0][0]), n01 = _mm_set1_ps(m[0][1]), n02 = _mm_set1_ps(m[0][2]), n03 = _mm_set1_ps(m[0][3]);
+    __m128 n10 = _mm_set1_ps(m[1][0]), n11 = _mm_set1_ps(m[1][1]), n12 = _mm_set1_ps(m[1][2]), n13 = _mm_set1_ps(m[1][3]);
+    __m128 n20 = _mm_set1_ps(m[2][0]), n21 = _mm_set1_ps(m[2][1]), n22 = _mm_set1_ps(m[2][2]), n23 = _mm_set1_ps(m[2][3]);
+    __m128 n30 = _mm_set1_ps(m[3][0]), n31 = _mm_set1_ps(m[3][1]), n32 = _mm_set1_ps(m[3][2]), n33 = _mm_set1_ps(m[3][3]);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&src[i].x);
+        __m128 y = _mm_loadu_ps(&src[i + 1].x);
+        __m128 z = _mm_loadu_ps(&src[i + 2].x);
+        __m128 w = _mm_loadu_ps(&src[i + 3].x);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+
+        __m128 rx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n00, x), _mm_mul_ps(n01, y)), _mm_mul_ps(n02, z)), n03);
+        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n10, x), _mm_mul_ps(n11, y)), _mm_mul_ps(n12, z)), n13);
+        __m128 rz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n20, x), _mm_mul_ps(n21, y)), _mm_mul_ps(n22, z)), n23);
+        __m128 rw = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(n30, x), _mm_mul_ps(n31, y)), _mm_mul_ps(n32, z)), n33);
+
+        // SSE2 has no blendv, so select with and/andnot.
+        __m128 divide = _mm_cmpneq_ps(rw, zero4);
+        rx = _mm_or_ps(_mm_and_ps(divide, _mm_div_ps(rx, rw)), _mm_andnot_ps(divide, rx));
+        ry = _mm_or_ps(_mm_and_ps(divide, _mm_div_ps(ry, rw)), _mm_andnot_ps(divide, ry));
+        rz = _mm_or_ps(_mm_and_ps(divide, _mm_div_ps(rz, rw)), _mm_andnot_ps(divide, rz));
+
+        _MM_TRANSPOSE4_PS(rx, ry, rz, rw);
+        _mm_storeu_ps(&dst[i].x, rx);
+        _mm_storeu_ps(&dst[i + 1].x, ry);
+        _mm_storeu_ps(&dst[i + 2].x, rz);
+        _mm_storeu_ps(&dst[i + 3].x, rw);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float x = src[i].x;
+        float y = src[i].y;
+        float z = src[i].z;
+        Vector4<float> p;
+        p.x = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+        p.y = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+        p.z = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+        p.w = m[3][0] * x + m[3][1] * y + m[3][2] * z + m[3][3];
+        if (p.w != 0.0000)
+        {
+            p.x /= p.w;
+            p.y /= p.w;
+            p.z /= p.w;
+        }
+        dst[i] = p;
+    }
+}
+
 Matrix4x4 Matrix4x4::RotAroundPoint(Vec3& point, Vec3& axis, const float& angle)
 {
     float translate4x4[][4] = {
@@ -477,4 +735,194 @@ Matrix4x4 Matrix4x4::RotAroundPoint(Vec3& point, Vec3& axis, const float& angle)
     return translate4x4 * Matrix4x4::RotAxisAngle(axis, angle) * translateInverse4x4;
 }
 
+//-------------------3x4 Affine---------------------
+/*
+    Affine transform stored as the top 3 rows of a 4x4 matrix. The bottom row is always {0, 0, 0, 1}, so it is not stored.
+    Model, view, TRS and TR matrices are all affine. Transforming a point costs 9 multiplies and no homogeneous divide,
+    and composing two of them costs 36 multiplies instead of 64.
+    Converts implicitly to Matrix4x4 when it needs to be combined with a projection matrix.
+*/
+class Matrix3x4
+{
+public:
+    float m[3][4] = {
+        {1, 0, 0, 0},
+        {0, 1, 0, 0},
+        {0, 0, 1, 0}
+    };
+
+    Matrix3x4() {}
+    Matrix3x4(const float matrix[3][4]) { Set(matrix); }
+
+    Matrix3x4(const Matrix3x3& rotation, const Vector3<float>& translation)
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                this->m[r][c] = rotation.m[r][c];
+            }
+        }
+        this->m[0][3] = translation.x;
+        this->m[1][3] = translation.y;
+        this->m[2][3] = translation.z;
+    }
+
+    // Drops the bottom row, which must be {0, 0, 0, 1} for the result to mean the same thing.
+    explicit Matrix3x4(const Matrix4x4& matrix)
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                this->m[r][c] = matrix.m[r][c];
+            }
+        }
+    }
+
+    void Set(const float matrix[3][4])
+    {
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                this->m[r][c] = matrix[r][c];
+            }
+        }
+    }
+
+    operator Matrix4x4() const
+    {
+        float matrix[4][4] =
+        {
+            {m[0][0], m[0][1], m[0][2], m[0][3]},
+            {m[1][0], m[1][1], m[1][2], m[1][3]},
+            {m[2][0], m[2][1], m[2][2], m[2][3]},
+            {0, 0, 0, 1}
+        };
+        return Matrix4x4(matrix);
+    }
+
+    Matrix3x3 Linear() const
+    {
+        float linear[3][3] =
+        {
+            {m[0][0], m[0][1], m[0][2]},
+            {m[1][0], m[1][1], m[1][2]},
+            {m[2][0], m[2][1], m[2][2]}
+        };
+        return Matrix3x3(linear);
+    }
+
+    Vector3<float> Translation() const { return Vector3<float>(m[0][3], m[1][3], m[2][3]); }
+
+    // A*B, both treated as 4x4 with an implicit {0, 0, 0, 1} bottom row
+    static Matrix3x4 Multiply(const Matrix3x4& matrixA, const Matrix3x4& matrixB)
+    {
+        Matrix3x4 result;
+#if defined(MATRIX_SSE)
+        __m128 b0 = _mm_loadu_ps(matrixB.m[0]);
+        __m128 b1 = _mm_loadu_ps(matrixB.m[1]);
+        __m128 b2 = _mm_loadu_ps(matrixB.m[2]);
+        for (size_t r = 0; r < 3; r++)
+        {
+            __m128 a = _mm_loadu_ps(matrixA.m[r]);
+            __m128 row = _mm_mul_ps(_mm_shuffle_ps(a, a, 0x00), b0);
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_shuffle_ps(a, a, 0x55), b1));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_shuffle_ps(a, a, 0xAA), b2));
+            // The implicit bottom row of B only contributes A's translation to the 4th column.
+            row = _mm_add_ps(row, _mm_and_ps(a, _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1))));
+            _mm_storeu_ps(result.m[r], row);
+        }
+#else
+        for (size_t r = 0; r < 3; r++)
+        {
+            for (size_t c = 0; c < 4; c++)
+            {
+                result.m[r][c] = matrixA.m[r][0] * matrixB.m[0][c] + matrixA.m[r][1] * matrixB.m[1][c] + matrixA.m[r][2] * matrixB.m[2][c];
+            }
+            result.m[r][3] += matrixA.m[r][3];
+        }
+#endif
+        return result;
+    }
+
+    // General affine inverse: [A | t]^-1 = [A^-1 | -A^-1 * t]
+    static Matrix3x4 Inverse(const Matrix3x4& matrix)
+    {
+        const float(&a)[3][4] = matrix.m;
+        float c00 = a[1][1] * a[2][2] - a[1][2] * a[2][1];
+        float c01 = a[1][2] * a[2][0] - a[1][0] * a[2][2];
+        float c02 = a[1][0] * a[2][1] - a[1][1] * a[2][0];
+        float det = a[0][0] * c00 + a[0][1] * c01 + a[0][2] * c02;
+        float invDet = det != 0.0f ? 1.0f / det : 0.0f;
+
+        Matrix3x4 inverse;
+        inverse.m[0][0] = c00 * invDet;
+        inverse.m[0][1] = (a[0][2] * a[2][1] - a[0][1] * a[2][2]) * invDet;
+        inverse.m[0][2] = (a[0][1] * a[1][2] - a[0][2] * a[1][1]) * invDet;
+        inverse.m[1][0] = c01 * invDet;
+        inverse.m[1][1] = (a[0][0] * a[2][2] - a[0][2] * a[2][0]) * invDet;
+        inverse.m[1][2] = (a[0][2] * a[1][0] - a[0][0] * a[1][2]) * invDet;
+        inverse.m[2][0] = c02 * invDet;
+        inverse.m[2][1] = (a[0][1] * a[2][0] - a[0][0] * a[2][1]) * invDet;
+        inverse.m[2][2] = (a[0][0] * a[1][1] - a[0][1] * a[1][0]) * invDet;
+        for (int r = 0; r < 3; r++)
+        {
+            inverse.m[r][3] = -(inverse.m[r][0] * a[0][3] + inverse.m[r][1] * a[1][3] + inverse.m[r][2] * a[2][3]);
+        }
+
+        return inverse;
+    }
+
+    // Same as matrixA = matrixA * matrixB
+    Matrix3x4& operator*=(const Matrix3x4& matrixB)
+    {
+        *this = Multiply(*this, matrixB);
+        return *this;
+    }
+};
+
+// A * B
+Matrix3x4 operator*(const Matrix3x4& matrixA, const Matrix3x4& matrixB)
+{
+    return Matrix3x4::Multiply(matrixA, matrixB);
+}
+// Projection * Affine
+Matrix4x4 operator*(const Matrix4x4& matrixA, const Matrix3x4& matrixB)
+{
+    return Matrix4x4::Multiply(matrixA, (Matrix4x4)matrixB);
+}
+// Affine * Projection
+Matrix4x4 operator*(const Matrix3x4& matrixA, const Matrix4x4& matrixB)
+{
+    return Matrix4x4::Multiply((Matrix4x4)matrixA, matrixB);
+}
+// M * p
+Vector3<float> operator*(const Matrix3x4& matrix, const Vector3<float>& point)
+{
+    const float(&m)[3][4] = matrix.m;
+    return Vector3<float>(
+        m[0][0] * point.x + m[0][1] * point.y + m[0][2] * point.z + m[0][3],
+        m[1][0] * point.x + m[1][1] * point.y + m[1][2] * point.z + m[1][3],
+        m[2][0] * point.x + m[2][1] * point.y + m[2][2] * point.z + m[2][3]
+    );
+}
+// M * p, w passes through unchanged (w = 0 transforms a direction)
+Vector4<float> operator*(const Matrix3x4& matrix, const Vector4<float>& point)
+{
+    const float(&m)[3][4] = matrix.m;
+    return Vector4<float>(
+        m[0][0] * point.x + m[0][1] * point.y + m[0][2] * point.z + m[0][3] * point.w,
+        m[1][0] * point.x + m[1][1] * point.y + m[1][2] * point.z + m[1][3] * point.w,
+        m[2][0] * point.x + m[2][1] * point.y + m[2][2] * point.z + m[2][3] * point.w,
+        point.w
+    );
+}
+
+void TransformPoints(const Matrix3x4& matrix, const Vector3<float>* src, Vector3<float>* dst, const size_t& count)
+{
+    TransformPoints(matrix.m, src, dst, count);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,1057 @@
+#pragma once
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+#include <Graphics.h>
+#include <MeshOptimizer.h>
+#include <MeshSimplifier.h>
+#include <charconv>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <filesystem>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+/*
+    Wavefront .obj/.mtl loading.
+    - The whole file is read into one buffer and walked line by line. Numbers are parsed in place with std::from_chars,
+      so no std::string is created per token.
+    - The .mtl is parsed once into a name -> color table when "mtllib" is seen, "usemtl" is a table lookup.
+    - Faces accept "v", "v/vt", "v//vn" and "v/vt/vn" references, negative (relative) indices, and polygons with more
+      than 3 corners (fan triangulated).
+    - Files of at least 2 * chunkSize are split at line boundaries and the chunks are parsed on the ThreadPool, each into
+      its own lists. The merge rebases face references and applies materials in file order, so the result is the
+      same as the sequential parse.
+    - After parsing, MeshOptimizer (MeshOptimizer.h) welds duplicate vertices and reorders the geometry for locality,
+      then MeshSimplifier (MeshSimplifier.h) builds its LOD chain.
+
+    Binary mesh cache (MeshCache):
+    The first load of Objects/X.obj writes Objects/X.obj.meshcache next to it. Later launches map that file and copy
+    the blocks straight into the geometry, no text is parsed. The cache is rebuilt whenever the size or modification
+    time of the .obj (or of the .mtl it uses) differs from what was recorded in its header, or when it was written with
+    MeshOptimizer::enabled set differently (flags).
+        [MeshCacheHeader]
+        [float r, g, b, a]    * materialCount      material table
+        1 + lodCount levels (the full mesh, then its LODs from MeshSimplifier), each:
+        [uint32 vertexCount, uint32 indexCount]
+        [float x, y, z]       * vertexCount
+        [uint32 index]        * indexCount
+        [uint16 material]     * indexCount / 3     per triangle index into the material table, padded to 4 bytes
+
+    Async loading (LoadMeshFromOBJFileAsync):
+    Returns a Mesh right away. Until its file is loaded on the ThreadPool the mesh holds a box of the asset's bounds
+    (from the .meshcache header when there is one) and Draw() shows it as a bounding box. Finished loads wait in a
+    queue that AsyncMeshLoader::Update() drains on the main thread once per frame, so Mesh objects and the geometry
+    registry are only ever touched from the main thread.
+*/
+
+struct OBJLoader
+{
+    static std::string directory;
+    static bool parallel;// Split big files into chunks parsed on the ThreadPool
+    static size_t chunkSize;
+
+    // Reads the whole file into buffer. Returns false if it can't be opened.
+    static bool ReadFile(const std::string& path, List<char>& buffer)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file.is_open()) {
+            return false;
+        }
+        std::streamsize size = file.tellg();
+        file.seekg(0, std::ios::beg);
+        buffer.resize((size_t)size);
+        return size == 0 || (bool)file.read(buffer.data(), size);
+    }
+
+    static bool IsSpace(const char& c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    static void SkipSpaces(const char*& p, const char* end)
+    {
+        while (p < end && IsSpace(*p)) {
+            p++;
+        }
+    }
+
+    static void SkipLine(const char*& p, const char* end)
+    {
+        while (p < end && *p != '\n') {
+            p++;
+        }
+        if (p < end) {
+            p++;
+        }
+    }
+
+    // Next whitespace separated word on the current line, length 0 at the end of the line.
+    static const char* NextWord(const char*& p, const char* end, size_t& length)
+    {
+        SkipSpaces(p, end);
+        const char* word = p;
+        while (p < end && !IsSpace(*p) && *p != '\n') {
+            p++;
+        }
+        length = p - word;
+        return word;
+    }
+
+    // Rest of the line without surrounding whitespace (names may contain spaces).
+    static std::string RestOfLine(const char*& p, const char* end)
+    {
+        SkipSpaces(p, end);
+        const char* begin = p;
+        while (p < end && *p != '\n') {
+            p++;
+        }
+        const char* last = p;
+        while (last > begin && IsSpace(last[-1])) {
+            last--;
+        }
+        return std::string(begin, last - begin);
+    }
+
+    static bool Keyword(const char* word, const size_t& length, const char* keyword)
+    {
+        size_t keywordLength = strlen(keyword);
+        return length == keywordLength && memcmp(word, keyword, length) == 0;
+    }
+
+    static bool ParseFloat(const char*& p, const char* end, float& value)
+    {
+        SkipSpaces(p, end);
+        if (p < end && *p == '+') {
+            p++;
+        }
+
+        // Fast path for plain decimals like -0.631035 (what exporters write): when the digits fit in 24 bits and
+        // there are at most 10 decimals, digits / 10^decimals is one correctly rounded division of two exact floats,
+        // so it gives the same float as from_chars. Anything else (exponents, long mantissas) goes to from_chars.
+        static const float powersOf10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+        const char* c = p;
+        bool negative = c < end && *c == '-';
+        if (negative) {
+            c++;
+        }
+        unsigned int digits = 0;
+        int digitCount = 0;
+        int decimals = 0;
+        bool anyDigits = c < end && *c >= '0' && *c <= '9';
+        while (c < end && *c >= '0' && *c <= '9' && digitCount < 8)
+        {
+            digits = digits * 10 + (*c++ - '0');
+            digitCount += digits != 0;
+        }
+        if (c < end && *c == '.')
+        {
+            c++;
+            anyDigits = anyDigits || (c < end && *c >= '0' && *c <= '9');
+            while (c < end && *c >= '0' && *c <= '9' && digitCount < 8 && decimals < 10)
+            {
+                digits = digits * 10 + (*c++ - '0');
+                digitCount += digits != 0;
+                decimals++;
+            }
+        }
+        bool plain = anyDigits && (c == end || IsSpace(*c) || *c == '\n') && digits < (1u << 24);
+        if (plain)
+        {
+            float result = (float)digits / powersOf10[decimals];
+            value = negative ? -result : result;
+            p = c;
+            return true;
+        }
+
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) {
+            return false;
+        }
+        p = result.ptr;
+        return true;
+    }
+
+    // Face indices are short runs of digits, a plain loop beats the general purpose from_chars<int> here.
+    static bool ParseIndex(const char*& p, const char* end, int& value)
+    {
+        bool negative = p < end && *p == '-';
+        const char* digits = negative ? p + 1 : p;
+        int result = 0;
+        const char* c = digits;
+        while (c < end && *c >= '0' && *c <= '9')
+        {
+            result = result * 10 + (*c - '0');
+            c++;
+        }
+        if (c == digits) {
+            return false;
+        }
+        value = negative ? -result : result;
+        p = c;
+        return true;
+    }
+
+    // Parses name -> diffuse color (Kd) for every material in the .mtl.
+    static std::unordered_map<std::string, Color> ParseMaterials(const std::string& path)
+    {
+        std::unordered_map<std::string, Color> materials;
+        List<char> buffer;
+        if (!ReadFile(path, buffer)) {
+            return materials;
+        }
+
+        const char* p = buffer.data();
+        const char* end = p + buffer.size();
+        std::string current = "";
+        while (p < end)
+        {
+            size_t length;
+            const char* word = NextWord(p, end, length);
+            if (Keyword(word, length, "newmtl")) {
+                current = RestOfLine(p, end);
+            }
+            else if (Keyword(word, length, "Kd"))
+            {
+                float r = 0, g = 0, b = 0;
+                if (ParseFloat(p, end, r) && ParseFloat(p, end, g) && ParseFloat(p, end, b)) {
+                    materials[current] = Color(255 * r, 255 * g, 255 * b);
+                }
+            }
+            SkipLine(p, end);
+        }
+        return materials;
+    }
+
+    // Fills geometry vertices, indices and triangles (with material colors). Call geometry.Build() afterwards.
+    // materialLibrary receives the "mtllib" file name, if any.
+    static bool Parse(const std::string& fileName, MeshGeometry& geometry, std::string* materialLibrary = nullptr)
+    {
+        List<char> buffer;
+        if (!ReadFile(directory + fileName, buffer)) {
+            return false;
+        }
+        // Without worker threads the chunks would run one after another, the merge would only add work
+        if (parallel && buffer.size() >= 2 * chunkSize && ThreadPool::Instance().WorkerCount() > 0) {
+            ParseParallel(buffer.data(), buffer.data() + buffer.size(), geometry, materialLibrary);
+        }
+        else {
+            ParseSequential(buffer.data(), buffer.data() + buffer.size(), geometry, materialLibrary);
+        }
+        return true;
+    }
+
+    // Counts the "v" and "f" lines so the lists can be allocated once (Triangle is large).
+    static void CountLines(const char* begin, const char* end, size_t& vertexLines, size_t& faceLines)
+    {
+        vertexLines = 0;
+        faceLines = 0;
+        for (const char* line = begin; line < end; line++)
+        {
+            if (line[0] == 'v' && line + 1 < end && IsSpace(line[1])) {
+                vertexLines++;
+            }
+            else if (line[0] == 'f' && line + 1 < end && IsSpace(line[1])) {
+                faceLines++;
+            }
+            line = (const char*)memchr(line, '\n', end - line);
+            if (!line) {
+                break;
+            }
+        }
+    }
+
+    // Reads the vertex references of an "f" record as written in the file (1 based, negative = relative).
+    static void ParseFace(const char*& p, const char* end, List<int>& face)
+    {
+        face.clear();
+        while (true)
+        {
+            SkipSpaces(p, end);
+            int index;
+            if (!ParseIndex(p, end, index)) {
+                break;
+            }
+            // Skip the texture/normal references, only positions are used
+            while (p < end && !IsSpace(*p) && *p != '\n') {
+                p++;
+            }
+            face.emplace_back(index);
+        }
+    }
+
+    // File reference -> 0 based vertex index, given how many vertices came before the face. -1 if it's invalid.
+    static int ResolveIndex(const int& reference, const int& vertexCount)
+    {
+        int index = reference < 0 ? vertexCount + reference : reference - 1;
+        return index < vertexCount ? index : -1;
+    }
+
+    static void ParseSequential(const char* begin, const char* end, MeshGeometry& geometry, std::string* materialLibrary)
+    {
+        List<Vec3>& verts = geometry.vertices;
+        List<int>& indices = geometry.indices;
+        List<Triangle>& triangles = geometry.triangles;
+        size_t vertexLines, faceLines;
+        CountLines(begin, end, vertexLines, faceLines);
+        verts.reserve(vertexLines);
+        indices.reserve(faceLines * 3);
+        triangles.reserve(faceLines);
+
+        std::unordered_map<std::string, Color> materials;
+        Material material;
+        List<int> face;
+
+        const char* p = begin;
+        while (p < end)
+        {
+            size_t length;
+            const char* word = NextWord(p, end, length);
+            if (length == 1 && word[0] == 'v')
+            {
+                Vec3 v;
+                if (ParseFloat(p, end, v.x) && ParseFloat(p, end, v.y) && ParseFloat(p, end, v.z)) {
+                    verts.emplace_back(v);
+                }
+            }
+            else if (length == 1 && word[0] == 'f')
+            {
+                ParseFace(p, end, face);
+                for (size_t i = 1; i + 1 < face.size(); i++)
+                {
+                    // Reversed winding to match the rest of the engine
+                    int p1Index = ResolveIndex(face[i + 1], (int)verts.size());
+                    int p2Index = ResolveIndex(face[i], (int)verts.size());
+                    int p3Index = ResolveIndex(face[0], (int)verts.size());
+                    if (p1Index < 0 || p2Index < 0 || p3Index < 0) {
+                        continue;
+                    }
+
+                    indices.emplace_back(p1Index);
+                    indices.emplace_back(p2Index);
+                    indices.emplace_back(p3Index);
+
+                    // Corners, normal and centroid are filled in by MeshGeometry::Build()
+                    triangles.emplace_back();
+                    triangles.back().color = material.color;
+                }
+            }
+            else if (Keyword(word, length, "usemtl"))
+            {
+                std::string name = RestOfLine(p, end);
+                auto found = materials.find(name);
+                if (found != materials.end()) {
+                    material = Material(name, found->second);
+                }
+            }
+            else if (Keyword(word, length, "mtllib"))
+            {
+                std::string library = RestOfLine(p, end);
+                materials = ParseMaterials(directory + library);
+                if (materialLibrary) {
+                    *materialLibrary = library;
+                }
+            }
+            SkipLine(p, end);
+        }
+    }
+
+    // What one worker pulls out of its slice of the file. Face references stay as written, they can only be
+    // resolved once the number of vertices in the chunks before this one is known.
+    struct Chunk
+    {
+        struct FaceTriangle
+        {
+            int references[3];// p1, p2, p3 (already in the engine's winding)
+            int vertexCount;// vertices in this chunk before the face
+        };
+        struct Event
+        {
+            size_t triangle;// takes effect from this triangle on
+            bool library;// mtllib, otherwise usemtl
+            std::string name;
+        };
+        const char* begin;
+        const char* end;
+        List<Vec3> vertices;
+        List<FaceTriangle> triangles;
+        List<Event> events;
+    };
+
+    static void ParseChunk(Chunk& chunk)
+    {
+        size_t vertexLines, faceLines;
+        CountLines(chunk.begin, chunk.end, vertexLines, faceLines);
+        chunk.vertices.reserve(vertexLines);
+        chunk.triangles.reserve(faceLines);
+        List<int> face;
+
+        const char* p = chunk.begin;
+        const char* end = chunk.end;
+        while (p < end)
+        {
+            size_t length;
+            const char* word = NextWord(p, end, length);
+            if (length == 1 && word[0] == 'v')
+            {
+                Vec3 v;
+                if (ParseFloat(p, end, v.x) && ParseFloat(p, end, v.y) && ParseFloat(p, end, v.z)) {
+                    chunk.vertices.emplace_back(v);
+                }
+            }
+            else if (length == 1 && word[0] == 'f')
+            {
+                ParseFace(p, end, face);
+                for (size_t i = 1; i + 1 < face.size(); i++) {
+                    chunk.triangles.push_back({ { face[i + 1], face[i], face[0] }, (int)chunk.vertices.size() });
+                }
+            }
+            else if (Keyword(word, length, "usemtl")) {
+                chunk.events.push_back({ chunk.triangles.size(), false, RestOfLine(p, end) });
+            }
+            else if (Keyword(word, length, "mtllib")) {
+                chunk.events.push_back({ chunk.triangles.size(), true, RestOfLine(p, end) });
+            }
+            SkipLine(p, end);
+        }
+    }
+
+    // Splits the buffer at line boundaries and parses the chunks on the ThreadPool, then merges them in file order
+    // (vertex lists appended, face references rebased on the vertices of earlier chunks, materials applied in order).
+    // Same output as ParseSequential().
+    static void ParseParallel(const char* begin, const char* end, MeshGeometry& geometry, std::string* materialLibrary)
+    {
+        List<Chunk> chunks;
+        const char* chunkBegin = begin;
+        while (chunkBegin < end)
+        {
+            const char* chunkEnd = end - chunkBegin > (ptrdiff_t)(chunkSize + chunkSize / 2) ? chunkBegin + chunkSize : end;
+            if (chunkEnd < end)
+            {
+                chunkEnd = (const char*)memchr(chunkEnd, '\n', end - chunkEnd);
+                chunkEnd = chunkEnd ? chunkEnd + 1 : end;
+            }
+            chunks.emplace_back();
+            chunks.back().begin = chunkBegin;
+            chunks.back().end = chunkEnd;
+            chunkBegin = chunkEnd;
+        }
+
+        ThreadPool::Instance().ParallelFor(chunks.size(), 1, [&chunks](size_t first, size_t last) {
+            for (size_t i = first; i < last; i++) {
+                ParseChunk(chunks[i]);
+            }
+        });
+
+        size_t vertexCount = 0;
+        size_t triangleCount = 0;
+        for (size_t c = 0; c < chunks.size(); c++)
+        {
+            vertexCount += chunks[c].vertices.size();
+            triangleCount += chunks[c].triangles.size();
+        }
+        List<Vec3>& verts = geometry.vertices;
+        List<int>& indices = geometry.indices;
+        List<Triangle>& triangles = geometry.triangles;
+        verts.reserve(vertexCount);
+        indices.reserve(triangleCount * 3);
+        triangles.reserve(triangleCount);
+
+        std::unordered_map<std::string, Color> materials;
+        Material material;
+        for (size_t c = 0; c < chunks.size(); c++)
+        {
+            Chunk& chunk = chunks[c];
+            int vertexBase = (int)verts.size();
+            verts.insert(verts.end(), chunk.vertices.begin(), chunk.vertices.end());
+
+            size_t nextEvent = 0;
+            for (size_t t = 0; t <= chunk.triangles.size(); t++)
+            {
+                for (; nextEvent < chunk.events.size() && chunk.events[nextEvent].triangle == t; nextEvent++)
+                {
+                    Chunk::Event& event = chunk.events[nextEvent];
+                    if (event.library)
+                    {
+                        materials = ParseMaterials(directory + event.name);
+                        if (materialLibrary) {
+                            *materialLibrary = event.name;
+                        }
+                    }
+                    else
+                    {
+                        auto found = materials.find(event.name);
+                        if (found != materials.end()) {
+                            material = Material(event.name, found->second);
+                        }
+                    }
+                }
+                if (t == chunk.triangles.size()) {
+                    break;
+                }
+
+                Chunk::FaceTriangle& tri = chunk.triangles[t];
+                int p1Index = ResolveIndex(tri.references[0], vertexBase + tri.vertexCount);
+                int p2Index = ResolveIndex(tri.references[1], vertexBase + tri.vertexCount);
+                int p3Index = ResolveIndex(tri.references[2], vertexBase + tri.vertexCount);
+                if (p1Index < 0 || p2Index < 0 || p3Index < 0) {
+                    continue;
+                }
+
+                indices.emplace_back(p1Index);
+                indices.emplace_back(p2Index);
+                indices.emplace_back(p3Index);
+
+                triangles.emplace_back();
+                triangles.back().color = material.color;
+            }
+        }
+    }
+};
+std::string OBJLoader::directory = "./Objects/";
+bool OBJLoader::parallel = true;
+size_t OBJLoader::chunkSize = 256 * 1024;
+
+// Read-only view of a whole file, memory mapped so only the pages that are touched get read.
+class MappedFile
+{
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+
+public:
+    MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            return;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            return;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mapping) {
+            return;
+        }
+        data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        size = data ? (size_t)fileSize.QuadPart : 0;
+#else
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            return;
+        }
+        struct stat info;
+        if (fstat(descriptor, &info) == 0 && info.st_size > 0)
+        {
+            void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (view != MAP_FAILED)
+            {
+                data = (const char*)view;
+                size = (size_t)info.st_size;
+            }
+        }
+        close(descriptor);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+#else
+        if (data) {
+            munmap((void*)data, size);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* Data() { return data; }
+    size_t Size() { return size; }
+};
+
+struct MeshCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    // Source files the cache was built from. A different size or time means the cache is stale.
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t materialLibrarySize;
+    int64_t materialLibraryTime;
+    char materialLibrary[128];
+    uint32_t materialCount;
+    uint32_t lodCount;
+    uint32_t flags;
+    uint32_t reserved;
+    float min[3];
+    float max[3];
+};
+
+struct MeshCache
+{
+    static const uint32_t version = 3;
+    static const uint32_t optimized = 1;// flags: MeshOptimizer ran on the geometry
+    static bool enabled;
+
+    static uint32_t Flags()
+    {
+        return MeshOptimizer::enabled ? optimized : 0;
+    }
+
+    static std::string PathFor(const std::string& objFileName)
+    {
+        return OBJLoader::directory + objFileName + ".meshcache";
+    }
+
+    // Size and last write time, false if the file doesn't exist.
+    static bool FileStamp(const std::string& path, uint64_t& size, int64_t& time)
+    {
+        std::error_code error;
+        size = (uint64_t)std::filesystem::file_size(path, error);
+        if (error) {
+            return false;
+        }
+        time = (int64_t)std::filesystem::last_write_time(path, error).time_since_epoch().count();
+        return !error;
+    }
+
+    // One level of detail: positions, indices and per triangle materials. block is advanced past it.
+    static bool ReadLevel(const char*& block, const char* end, const float* materials, const uint32_t& materialCount,
+        MeshGeometry& geometry)
+    {
+        uint32_t counts[2];
+        if ((size_t)(end - block) < sizeof(counts)) {
+            return false;
+        }
+        memcpy(counts, block, sizeof(counts));
+        block += sizeof(counts);
+        uint32_t vertexCount = counts[0];
+        uint32_t indexCount = counts[1];
+        size_t materialsSize = ((indexCount / 3) * sizeof(uint16_t) + 3) & ~(size_t)3;
+        size_t size = (size_t)vertexCount * 3 * sizeof(float) + (size_t)indexCount * sizeof(uint32_t) + materialsSize;
+        if (indexCount % 3 != 0 || (size_t)(end - block) < size) {
+            return false;
+        }
+
+        const float* positions = (const float*)block;
+        block += (size_t)vertexCount * 3 * sizeof(float);
+        const uint32_t* indices = (const uint32_t*)block;
+        block += (size_t)indexCount * sizeof(uint32_t);
+        const uint16_t* triangleMaterials = (const uint16_t*)block;
+        block += materialsSize;
+
+        geometry.vertices.resize(vertexCount);
+        for (size_t i = 0; i < vertexCount; i++) {
+            geometry.vertices[i] = Vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+        }
+        geometry.indices.resize(indexCount);
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            if (indices[i] >= vertexCount) {
+                return false;
+            }
+            geometry.indices[i] = (int)indices[i];
+        }
+        geometry.triangles.resize(indexCount / 3);
+        for (size_t i = 0; i < geometry.triangles.size(); i++)
+        {
+            const float* color = materials + (size_t)(triangleMaterials[i] < materialCount ? triangleMaterials[i] : 0) * 4;
+            geometry.triangles[i].color = materialCount > 0 ? Color(color[0], color[1], color[2], color[3]) : Color::white;
+        }
+        return true;
+    }
+
+    static void Append(List<char>& buffer, const void* data, const size_t& size)
+    {
+        buffer.insert(buffer.end(), (const char*)data, (const char*)data + size);
+    }
+
+    static bool WriteLevel(List<char>& buffer, MeshGeometry& geometry, List<Color>& materials)
+    {
+        uint32_t counts[2] = { (uint32_t)geometry.vertices.size(), (uint32_t)geometry.indices.size() };
+        Append(buffer, counts, sizeof(counts));
+        for (size_t i = 0; i < geometry.vertices.size(); i++)
+        {
+            float position[3] = { geometry.vertices[i].x, geometry.vertices[i].y, geometry.vertices[i].z };
+            Append(buffer, position, sizeof(position));
+        }
+        for (size_t i = 0; i < geometry.indices.size(); i++)
+        {
+            uint32_t index = (uint32_t)geometry.indices[i];
+            Append(buffer, &index, sizeof(index));
+        }
+        for (size_t i = 0; i < geometry.triangles.size(); i++)
+        {
+            Color& c = geometry.triangles[i].color;
+            size_t m = 0;
+            while (m < materials.size() && !(materials[m].r == c.r && materials[m].g == c.g && materials[m].b == c.b && materials[m].a == c.a)) {
+                m++;
+            }
+            if (m == materials.size()) {
+                return false;
+            }
+            uint16_t material = (uint16_t)m;
+            Append(buffer, &material, sizeof(material));
+        }
+        if (geometry.triangles.size() % 2 != 0)
+        {
+            uint16_t padding = 0;
+            Append(buffer, &padding, sizeof(padding));
+        }
+        return true;
+    }
+
+    // Just the bounds from the cache header (no mapping), false if there is no up to date cache.
+    static bool ReadBounds(const std::string& objFileName, Vec3& min, Vec3& max)
+    {
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!enabled || !FileStamp(OBJLoader::directory + objFileName, sourceSize, sourceTime)) {
+            return false;
+        }
+        MeshCacheHeader header;
+        std::ifstream file(PathFor(objFileName), std::ios::binary);
+        if (!file.is_open() || !file.read((char*)&header, sizeof(MeshCacheHeader))) {
+            return false;
+        }
+        if (memcmp(header.magic, "MESH", 4) != 0 || header.version != version || header.flags != Flags() ||
+            header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+            return false;
+        }
+        min = Vec3(header.min[0], header.min[1], header.min[2]);
+        max = Vec3(header.max[0], header.max[1], header.max[2]);
+        return true;
+    }
+
+    // Fills geometry (including Build()) from the cache file. False if there is no valid, up to date cache.
+    static bool Read(const std::string& objFileName, MeshGeometry& geometry)
+    {
+        uint64_t sourceSize;
+        int64_t sourceTime;
+        if (!enabled || !FileStamp(OBJLoader::directory + objFileName, sourceSize, sourceTime)) {
+            return false;
+        }
+
+        MappedFile file = MappedFile(PathFor(objFileName));
+        if (file.Size() < sizeof(MeshCacheHeader)) {
+            return false;
+        }
+        MeshCacheHeader header;
+        memcpy(&header, file.Data(), sizeof(MeshCacheHeader));
+        if (memcmp(header.magic, "MESH", 4) != 0 || header.version != version || header.flags != Flags() ||
+            header.sourceSize != sourceSize || header.sourceTime != sourceTime) {
+            return false;
+        }
+        if (header.materialLibrary[0] != '\0')
+        {
+            uint64_t librarySize = 0;
+            int64_t libraryTime = 0;
+            std::string library = std::string(header.materialLibrary, strnlen(header.materialLibrary, sizeof(header.materialLibrary)));
+            FileStamp(OBJLoader::directory + library, librarySize, libraryTime);
+            if (librarySize != header.materialLibrarySize || libraryTime != header.materialLibraryTime) {
+                return false;
+            }
+        }
+
+        const char* block = file.Data() + sizeof(MeshCacheHeader);
+        const char* end = file.Data() + file.Size();
+        if ((size_t)(end - block) < (size_t)header.materialCount * 4 * sizeof(float)) {
+            return false;
+        }
+        const float* materials = (const float*)block;
+        block += (size_t)header.materialCount * 4 * sizeof(float);
+
+        if (!ReadLevel(block, end, materials, header.materialCount, geometry)) {
+            return false;
+        }
+        geometry.min = Vec3(header.min[0], header.min[1], header.min[2]);
+        geometry.max = Vec3(header.max[0], header.max[1], header.max[2]);
+        geometry.Build(false);
+        geometry.lods.clear();
+        for (uint32_t level = 0; level < header.lodCount; level++)
+        {
+            std::shared_ptr<MeshGeometry> lod = std::make_shared<MeshGeometry>();
+            if (!ReadLevel(block, end, materials, header.materialCount, *lod)) {
+                return false;
+            }
+            lod->Build();
+            geometry.lods.emplace_back(lod);
+        }
+        return block == end;
+    }
+
+    // Writes the cache for a geometry that was just parsed from objFileName. Failing to write (read-only folder) is fine,
+    // the asset just gets parsed again next time.
+    static void Write(const std::string& objFileName, MeshGeometry& geometry, const std::string& materialLibrary)
+    {
+        MeshCacheHeader header = {};
+        memcpy(header.magic, "MESH", 4);
+        header.version = version;
+        header.flags = Flags();
+        if (!enabled || !FileStamp(OBJLoader::directory + objFileName, header.sourceSize, header.sourceTime) ||
+            materialLibrary.size() >= sizeof(header.materialLibrary)) {
+            return;
+        }
+        if (!materialLibrary.empty())
+        {
+            memcpy(header.materialLibrary, materialLibrary.data(), materialLibrary.size());
+            FileStamp(OBJLoader::directory + materialLibrary, header.materialLibrarySize, header.materialLibraryTime);
+        }
+
+        // Material table: the distinct triangle colors, usually a handful. LODs keep the colors of the full mesh.
+        List<Color> materials;
+        for (size_t i = 0; i < geometry.triangles.size(); i++)
+        {
+            Color& c = geometry.triangles[i].color;
+            size_t m = 0;
+            while (m < materials.size() && !(materials[m].r == c.r && materials[m].g == c.g && materials[m].b == c.b && materials[m].a == c.a)) {
+                m++;
+            }
+            if (m == materials.size())
+            {
+                if (materials.size() == 0xFFFF) {
+                    return;
+                }
+                materials.emplace_back(c);
+            }
+        }
+
+        header.materialCount = (uint32_t)materials.size();
+        header.lodCount = (uint32_t)geometry.lods.size();
+        header.min[0] = geometry.min.x;
+        header.min[1] = geometry.min.y;
+        header.min[2] = geometry.min.z;
+        header.max[0] = geometry.max.x;
+        header.max[1] = geometry.max.y;
+        header.max[2] = geometry.max.z;
+
+        List<char> buffer;
+        Append(buffer, &header, sizeof(MeshCacheHeader));
+        for (size_t i = 0; i < materials.size(); i++)
+        {
+            float color[4] = { materials[i].r, materials[i].g, materials[i].b, materials[i].a };
+            Append(buffer, color, sizeof(color));
+        }
+        if (!WriteLevel(buffer, geometry, materials)) {
+            return;
+        }
+        for (size_t i = 0; i < geometry.lods.size(); i++)
+        {
+            if (!WriteLevel(buffer, *geometry.lods[i], materials)) {
+                return;
+            }
+        }
+
+        // Written under a temporary name and renamed, so an interrupted write never leaves a half file behind. The name
+        // is unique to this write (thread and counter), so loads of the same asset racing each other never share it.
+        static std::atomic<unsigned int> writeCount{ 0 };
+        std::string path = PathFor(objFileName);
+        std::string temporaryPath = path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()))
+            + "." + std::to_string(writeCount++) + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            if (!file.is_open() || !file.write(buffer.data(), buffer.size())) {
+                return;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temporaryPath, path, error);
+        if (error) {
+            std::filesystem::remove(temporaryPath, error);
+        }
+    }
+};
+bool MeshCache::enabled = true;
+
+// Built geometry from the .meshcache, or from the .obj (writing the cache). Doesn't touch the registry, so it can
+// run on a worker thread. nullptr if the file can't be read.
+std::shared_ptr<MeshGeometry> LoadGeometryFromOBJFile(const std::string& objFileName)
+{
+    std::shared_ptr<MeshGeometry> geometry = std::make_shared<MeshGeometry>();
+    if (MeshCache::Read(objFileName, *geometry)) {
+        return geometry;
+    }
+
+    *geometry = MeshGeometry();
+    std::string materialLibrary;
+    if (!OBJLoader::Parse(objFileName, *geometry, &materialLibrary)) {
+        return nullptr;
+    }
+    if (MeshOptimizer::enabled) {
+        MeshOptimizer::Optimize(*geometry);
+    }
+    geometry->Build();
+    MeshSimplifier::BuildLODs(*geometry);
+    MeshCache::Write(objFileName, *geometry, materialLibrary);
+    return geometry;
+}
+
+Mesh* LoadMeshFromOBJFile(std::string objFileName)
+{
+    // Every file is parsed once. Later loads share its geometry and only allocate the per instance state.
+    std::shared_ptr<MeshGeometry> geometry = MeshGeometry::Find(objFileName);
+    if (!geometry)
+    {
+        geometry = LoadGeometryFromOBJFile(objFileName);
+        if (geometry) {
+            MeshGeometry::Register(objFileName, geometry);
+        }
+    }
+
+    Mesh* mesh = new Mesh();
+    mesh->SetGeometry(geometry);
+    return mesh;
+}
+
+struct AsyncMeshLoader
+{
+    struct Result
+    {
+        std::string fileName;
+        std::shared_ptr<MeshGeometry> geometry;// nullptr if the file couldn't be read
+    };
+
+    static std::mutex mutex;
+    static List<Result> completed;// Filled by the workers, guarded by mutex
+    // Main thread only
+    static std::unordered_map<std::string, List<Mesh*>> waiting;
+    // One per file whose load is in flight (even if every mesh waiting for it was deleted), the box its meshes show
+    static std::unordered_map<std::string, std::shared_ptr<MeshGeometry>> placeholders;
+
+    static Mesh* Load(const std::string& objFileName)
+    {
+        Mesh* mesh = new Mesh();
+        std::shared_ptr<MeshGeometry> geometry = MeshGeometry::Find(objFileName);
+        if (geometry)
+        {
+            mesh->SetGeometry(geometry);
+            return mesh;
+        }
+
+        if (placeholders.find(objFileName) == placeholders.end())
+        {
+            // No load of this file in flight: make its placeholder and start one
+            Vec3 min = Vec3(-0.5, -0.5, -0.5);
+            Vec3 max = Vec3(0.5, 0.5, 0.5);
+            MeshCache::ReadBounds(objFileName, min, max);
+            placeholders[objFileName] = MeshGeometry::Box(min, max);
+
+            ThreadPool::Instance().Submit([objFileName]() {
+                std::shared_ptr<MeshGeometry> loaded = LoadGeometryFromOBJFile(objFileName);
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.push_back({ objFileName, loaded });
+            });
+        }
+        waiting[objFileName].emplace_back(mesh);
+        mesh->SetGeometry(placeholders[objFileName]);
+        mesh->loading = true;
+        return mesh;
+    }
+
+    // Hands finished loads to their meshes. Called once per frame from the main loop.
+    static void Update()
+    {
+        List<Result> results;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (completed.empty()) {
+                return;
+            }
+            results.swap(completed);
+        }
+
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            Result& result = results[i];
+            // A synchronous load of the same file may have registered it in the meantime
+            std::shared_ptr<MeshGeometry> geometry = MeshGeometry::Find(result.fileName);
+            if (!geometry && result.geometry)
+            {
+                geometry = result.geometry;
+                MeshGeometry::Register(result.fileName, geometry);
+            }
+
+            auto found = waiting.find(result.fileName);
+            if (found != waiting.end())
+            {
+                for (size_t m = 0; m < found->second.size(); m++)
+                {
+                    Mesh* mesh = found->second[m];
+                    mesh->loading = false;
+                    mesh->SetGeometry(geometry);
+                }
+                waiting.erase(found);
+            }
+            placeholders.erase(result.fileName);
+        }
+    }
+
+    // Meshes deleted before their load finished
+    static void Cancel(Mesh* mesh)
+    {
+        for (auto it = waiting.begin(); it != waiting.end(); it++)
+        {
+            List<Mesh*>& meshes = it->second;
+            auto found = std::find(meshes.begin(), meshes.end(), mesh);
+            if (found != meshes.end())
+            {
+                meshes.erase(found);
+                if (meshes.empty()) {
+                    waiting.erase(it);
+                }
+                return;
+            }
+        }
+    }
+
+    // Meshes still showing a placeholder
+    static int Pending()
+    {
+        int count = 0;
+        for (auto it = waiting.begin(); it != waiting.end(); it++) {
+            count += (int)it->second.size();
+        }
+        return count;
+    }
+};
+std::mutex AsyncMeshLoader::mutex;
+List<AsyncMeshLoader::Result> AsyncMeshLoader::completed;
+std::unordered_map<std::string, List<Mesh*>> AsyncMeshLoader::waiting;
+std::unordered_map<std::string, std::shared_ptr<MeshGeometry>> AsyncMeshLoader::placeholders;
+
+void CancelMeshLoad(Mesh* mesh)
+{
+    AsyncMeshLoader::Cancel(mesh);
+}
+
+// Returns immediately. The mesh shows a bounding box placeholder until AsyncMeshLoader::Update() attaches the geometry.
+Mesh* LoadMeshFromOBJFileAsync(std::string objFileName)
+{
+    return AsyncMeshLoader::Load(objFileName);
+}
+
+#endif
@@ -0,0 +1,490 @@
+#pragma once
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+#include <Graphics.h>
+#include <unordered_map>
+#include <cstdint>
+#include <queue>
+#include <math.h>
+/*
+    Load time clean up of indexed geometry, run on vertices/indices/triangle colors before MeshGeometry::Build().
+    1. Weld: vertices closer than weldEpsilon become one (spatial hash, cell size = epsilon, 27 neighbor cells searched).
+    2. Degenerates: triangles with a repeated index or zero area are removed.
+    3. Triangle order: Forsyth's "linear speed vertex cache optimisation", so consecutive triangles reuse the same few
+       vertices. With step 5 the vertices a draw uses sit close together, and TransformTriangles() packs them in
+       one forward scan over that range.
+    4. Clusters: triangles are grouped into runs of MeshGeometry::meshletMaxTriangles that are close together and face
+       the same way, which MeshGeometry::BuildMeshlets() turns into meshlets with tight spheres and normal cones.
+       Forsyth's order is then applied again inside each run.
+    5. Vertex order: renumbered in first use order, so vertex reads follow the index walk. Unused vertices are dropped.
+    Triangle colors move with their triangles.
+*/
+
+struct MeshOptimizer
+{
+    static bool enabled;// Run by LoadGeometryFromOBJFile (also part of the .meshcache key)
+    static float weldEpsilon;// Model units
+    static int cacheSize;// Simulated vertex cache for the triangle order
+
+    struct Stats
+    {
+        size_t verticesBefore = 0;
+        size_t verticesAfter = 0;
+        size_t trianglesBefore = 0;
+        size_t trianglesAfter = 0;
+        float acmrBefore = 0;// Average cache misses per triangle (3 = no reuse)
+        float acmrAfter = 0;
+    };
+
+    static Stats Optimize(MeshGeometry& geometry)
+    {
+        Stats stats;
+        stats.verticesBefore = geometry.vertices.size();
+        stats.trianglesBefore = geometry.indices.size() / 3;
+        stats.acmrBefore = ACMR(geometry.indices, cacheSize);
+
+        Weld(geometry, weldEpsilon);
+        RemoveDegenerates(geometry);
+        Reorder(geometry);
+
+        stats.verticesAfter = geometry.vertices.size();
+        stats.trianglesAfter = geometry.indices.size() / 3;
+        stats.acmrAfter = ACMR(geometry.indices, cacheSize);
+        return stats;
+    }
+
+    // Steps 3 to 5, also used on simplified levels (MeshSimplifier)
+    static void Reorder(MeshGeometry& geometry)
+    {
+        size_t clusterSize = (size_t)MeshGeometry::meshletMaxTriangles;
+        ReorderTriangles(geometry, cacheSize);
+        ClusterTriangles(geometry, clusterSize);
+        ReorderTriangles(geometry, cacheSize, clusterSize);
+        ReorderVertices(geometry);
+    }
+
+    static uint64_t CellKey(int64_t x, int64_t y, int64_t z)
+    {
+        return (uint64_t)x * 73856093ull ^ (uint64_t)y * 19349663ull ^ (uint64_t)z * 83492791ull;
+    }
+
+    // Points indices at the first vertex within epsilon. The vertex list itself is compacted by ReorderVertices().
+    static void Weld(MeshGeometry& geometry, const float& epsilon)
+    {
+        List<Vec3>& vertices = geometry.vertices;
+        if (vertices.empty() || epsilon <= 0) {
+            return;
+        }
+
+        // Each cell holds a chain of the kept vertices inside it (next[] links). Hash collisions between cells only
+        // add candidates, the distance test decides.
+        float invCell = 1.0f / epsilon;
+        float sqrEpsilon = epsilon * epsilon;
+        std::unordered_map<uint64_t, int> cells;
+        cells.reserve(vertices.size());
+        List<int> next = List<int>(vertices.size(), -1);
+        List<int> remap = List<int>(vertices.size());
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            Vec3& v = vertices[i];
+            int64_t cx = (int64_t)floor(v.x * invCell);
+            int64_t cy = (int64_t)floor(v.y * invCell);
+            int64_t cz = (int64_t)floor(v.z * invCell);
+
+            int match = -1;
+            for (int64_t dx = -1; dx <= 1 && match < 0; dx++)
+            {
+                for (int64_t dy = -1; dy <= 1 && match < 0; dy++)
+                {
+                    for (int64_t dz = -1; dz <= 1 && match < 0; dz++)
+                    {
+                        auto cell = cells.find(CellKey(cx + dx, cy + dy, cz + dz));
+                        for (int j = cell != cells.end() ? cell->second : -1; j >= 0; j = next[j])
+                        {
+                            Vec3 d = vertices[j] - v;
+                            if (d.x * d.x + d.y * d.y + d.z * d.z <= sqrEpsilon)
+                            {
+                                match = j;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (match >= 0) {
+                remap[i] = match;
+            }
+            else
+            {
+                remap[i] = (int)i;
+                auto inserted = cells.emplace(CellKey(cx, cy, cz), (int)i);
+                if (!inserted.second)
+                {
+                    next[i] = inserted.first->second;
+                    inserted.first->second = (int)i;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < geometry.indices.size(); i++) {
+            geometry.indices[i] = remap[geometry.indices[i]];
+        }
+    }
+
+    static void RemoveDegenerates(MeshGeometry& geometry)
+    {
+        List<Vec3>& vertices = geometry.vertices;
+        List<int>& indices = geometry.indices;
+        List<Triangle>& triangles = geometry.triangles;
+        size_t count = indices.size() / 3;
+        size_t kept = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            int a = indices[i * 3];
+            int b = indices[i * 3 + 1];
+            int c = indices[i * 3 + 2];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+            Vec3 normal = CrossProduct(vertices[c] - vertices[a], vertices[b] - vertices[a]);
+            if (normal.x == 0 && normal.y == 0 && normal.z == 0) {
+                continue;
+            }
+
+            indices[kept * 3] = a;
+            indices[kept * 3 + 1] = b;
+            indices[kept * 3 + 2] = c;
+            if (i < triangles.size()) {
+                triangles[kept] = triangles[i];
+            }
+            kept++;
+        }
+        indices.resize(kept * 3);
+        if (triangles.size() > kept) {
+            triangles.resize(kept);
+        }
+    }
+
+    // Forsyth's vertex score: recently used vertices score high (the last triangle's 3 a little lower, so strips
+    // don't run forever), and vertices with few triangles left get a boost so they are finished and leave the cache.
+    static float VertexScore(const int& cachePosition, const int& remainingTriangles, const int& cacheSize)
+    {
+        if (remainingTriangles == 0) {
+            return -1.0f;
+        }
+        float score = 0;
+        if (cachePosition >= 0)
+        {
+            if (cachePosition < 3) {
+                score = 0.75f;
+            }
+            else {
+                score = powf(1.0f - (float)(cachePosition - 3) / (float)(cacheSize - 3), 1.5f);
+            }
+        }
+        return score + 2.0f * powf((float)remainingTriangles, -0.5f);
+    }
+
+    // runSize > 0 keeps each run of runSize triangles (a meshlet) together and only orders within it.
+    static void ReorderTriangles(MeshGeometry& geometry, const int& cacheSize, const size_t& runSize = 0)
+    {
+        List<int>& indices = geometry.indices;
+        size_t triangleCount = indices.size() / 3;
+        size_t vertexCount = geometry.vertices.size();
+        if (triangleCount < 2) {
+            return;
+        }
+
+        // Vertex -> triangle adjacency. The first remaining[v] entries of a vertex's range are its unemitted triangles.
+        List<int> remaining = List<int>(vertexCount, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            remaining[indices[i]]++;
+        }
+        List<int> offsets = List<int>(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            offsets[v + 1] = offsets[v] + remaining[v];
+        }
+        List<int> adjacency = List<int>(indices.size());
+        List<int> fill = List<int>(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = (int)(i / 3);
+        }
+
+        List<int> cachePosition = List<int>(vertexCount, -1);
+        List<float> vertexScore = List<float>(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vertexScore[v] = VertexScore(-1, remaining[v], cacheSize);
+        }
+
+        List<char> emitted = List<char>(triangleCount, 0);
+        List<int> order;
+        order.reserve(triangleCount);
+        List<int> cache;
+        List<int> newCache;
+        cache.reserve(cacheSize + 3);
+        newCache.reserve(cacheSize + 3);
+        size_t cursor = 0;
+        size_t runBegin = 0;
+        size_t runEnd = runSize > 0 && runSize < triangleCount ? runSize : triangleCount;
+        int best = -1;
+
+        while (order.size() < triangleCount)
+        {
+            if (order.size() == runEnd)
+            {
+                runBegin = runEnd;
+                runEnd = runSize > 0 && runBegin + runSize < triangleCount ? runBegin + runSize : triangleCount;
+                cursor = runBegin;
+                best = -1;
+            }
+            if (best < 0)
+            {
+                // Nothing left around the cache: continue from the next unemitted triangle in file order
+                while (emitted[cursor]) {
+                    cursor++;
+                }
+                best = (int)cursor;
+            }
+
+            emitted[best] = 1;
+            order.emplace_back(best);
+
+            // Drop the triangle from its vertices' remaining lists, and put its vertices at the front of the cache
+            newCache.clear();
+            for (int k = 0; k < 3; k++)
+            {
+                int v = indices[best * 3 + k];
+                int* begin = &adjacency[offsets[v]];
+                int* last = begin + remaining[v] - 1;
+                for (int* t = begin; t <= last; t++)
+                {
+                    if (*t == best)
+                    {
+                        std::swap(*t, *last);
+                        break;
+                    }
+                }
+                remaining[v]--;
+                newCache.emplace_back(v);
+            }
+            for (size_t c = 0; c < cache.size(); c++)
+            {
+                int v = cache[c];
+                if (v != newCache[0] && v != newCache[1] && v != newCache[2]) {
+                    newCache.emplace_back(v);
+                }
+            }
+
+            // Rescore everything that was or is in the cache, and pick the best triangle touching it
+            for (size_t c = 0; c < newCache.size(); c++)
+            {
+                int v = newCache[c];
+                cachePosition[v] = c < (size_t)cacheSize ? (int)c : -1;
+                vertexScore[v] = VertexScore(cachePosition[v], remaining[v], cacheSize);
+            }
+            best = -1;
+            float bestScore = -1;
+            for (size_t c = 0; c < newCache.size(); c++)
+            {
+                int v = newCache[c];
+                for (int j = offsets[v]; j < offsets[v] + remaining[v]; j++)
+                {
+                    int t = adjacency[j];
+                    if ((size_t)t < runBegin || (size_t)t >= runEnd) {
+                        continue;
+                    }
+                    float score = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                    if (score > bestScore)
+                    {
+                        bestScore = score;
+                        best = t;
+                    }
+                }
+            }
+
+            if (newCache.size() > (size_t)cacheSize) {
+                newCache.resize(cacheSize);
+            }
+            cache.swap(newCache);
+        }
+
+        ApplyTriangleOrder(geometry, order);
+    }
+
+    // Triangle order[t] moves to position t, with its color
+    static void ApplyTriangleOrder(MeshGeometry& geometry, const List<int>& order)
+    {
+        List<int>& indices = geometry.indices;
+        size_t triangleCount = order.size();
+        List<int> reorderedIndices = List<int>(indices.size());
+        List<Triangle> reorderedTriangles = List<Triangle>(geometry.triangles.size());
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            int source = order[t];
+            reorderedIndices[t * 3] = indices[source * 3];
+            reorderedIndices[t * 3 + 1] = indices[source * 3 + 1];
+            reorderedIndices[t * 3 + 2] = indices[source * 3 + 2];
+            if ((size_t)source < geometry.triangles.size()) {
+                reorderedTriangles[t] = geometry.triangles[source];
+            }
+        }
+        indices.swap(reorderedIndices);
+        geometry.triangles.swap(reorderedTriangles);
+    }
+
+    // Greedy region growing: each cluster starts at the first unassigned triangle (in the current, cache friendly order)
+    // and takes the neighbour (shared vertex) that best matches its average normal and stays close to its center.
+    // Every cluster but the last has exactly clusterSize triangles; a region that runs out of neighbours continues
+    // from the next unassigned triangle.
+    static void ClusterTriangles(MeshGeometry& geometry, const size_t& clusterSize)
+    {
+        List<int>& indices = geometry.indices;
+        List<Vec3>& vertices = geometry.vertices;
+        size_t triangleCount = indices.size() / 3;
+        size_t vertexCount = vertices.size();
+        if (clusterSize == 0 || triangleCount <= clusterSize) {
+            return;
+        }
+
+        List<Vec3> normals = List<Vec3>(triangleCount);
+        List<Vec3> centroids = List<Vec3>(triangleCount);
+        double edgeLengthSum = 0;
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            Vec3 a = vertices[indices[t * 3]];
+            Vec3 b = vertices[indices[t * 3 + 1]];
+            Vec3 c = vertices[indices[t * 3 + 2]];
+            Vec3 ab = b - a;
+            Vec3 ac = c - a;
+            Vec3 n = Vec3(ab.y * ac.z - ab.z * ac.y, ab.z * ac.x - ab.x * ac.z, ab.x * ac.y - ab.y * ac.x);
+            float length = sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+            normals[t] = length > 0 ? n * (1.0f / length) : Vec3(0, 0, 0);
+            centroids[t] = (a + b + c) * (1.0f / 3.0f);
+            edgeLengthSum += sqrt(ab.x * ab.x + ab.y * ab.y + ab.z * ab.z);
+        }
+        // Distance is measured in edge lengths: 8 edges away costs as much as a normal turned 60 degrees
+        float averageEdge = (float)(edgeLengthSum / triangleCount);
+        float distanceWeight = averageEdge > 0 ? 0.5f / (8.0f * averageEdge) : 0.0f;
+
+        // Vertex -> triangle adjacency
+        List<int> offsets = List<int>(vertexCount + 1, 0);
+        for (size_t i = 0; i < indices.size(); i++) {
+            offsets[indices[i] + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) {
+            offsets[v + 1] += offsets[v];
+        }
+        List<int> adjacency = List<int>(indices.size());
+        List<int> fill = List<int>(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) {
+            adjacency[fill[indices[i]]++] = (int)(i / 3);
+        }
+
+        List<char> assigned = List<char>(triangleCount, 0);
+        List<int> order;
+        order.reserve(triangleCount);
+        std::priority_queue<std::pair<float, int>> candidates;
+        size_t cursor = 0;
+        while (order.size() < triangleCount)
+        {
+            candidates = std::priority_queue<std::pair<float, int>>();
+            Vec3 normalSum = Vec3(0, 0, 0);
+            Vec3 centroidSum = Vec3(0, 0, 0);
+            size_t clusterBegin = order.size();
+            size_t clusterEnd = clusterBegin + clusterSize < triangleCount ? clusterBegin + clusterSize : triangleCount;
+            while (order.size() < clusterEnd)
+            {
+                int t = -1;
+                while (!candidates.empty() && t < 0)
+                {
+                    int candidate = candidates.top().second;
+                    candidates.pop();
+                    if (!assigned[candidate]) {
+                        t = candidate;
+                    }
+                }
+                if (t < 0)
+                {
+                    while (assigned[cursor]) {
+                        cursor++;
+                    }
+                    t = (int)cursor;
+                }
+
+                assigned[t] = 1;
+                order.emplace_back(t);
+                normalSum = normalSum + normals[t];
+                centroidSum = centroidSum + centroids[t];
+                float axisLength = sqrt(normalSum.x * normalSum.x + normalSum.y * normalSum.y + normalSum.z * normalSum.z);
+                Vec3 axis = axisLength > 0 ? normalSum * (1.0f / axisLength) : Vec3(0, 0, 0);
+                Vec3 center = centroidSum * (1.0f / (float)(order.size() - clusterBegin));
+
+                // Scores are taken when a triangle is reached and not updated as the cluster grows
+                for (int k = 0; k < 3; k++)
+                {
+                    int v = indices[t * 3 + k];
+                    for (int j = offsets[v]; j < offsets[v + 1]; j++)
+                    {
+                        int neighbour = adjacency[j];
+                        if (assigned[neighbour]) {
+                            continue;
+                        }
+                        Vec3 n = normals[neighbour];
+                        Vec3 d = centroids[neighbour] - center;
+                        float score = (axis.x * n.x + axis.y * n.y + axis.z * n.z)
+                            - sqrt(d.x * d.x + d.y * d.y + d.z * d.z) * distanceWeight;
+                        candidates.emplace(score, neighbour);
+                    }
+                }
+            }
+        }
+
+        ApplyTriangleOrder(geometry, order);
+    }
+
+    // Renumbers vertices in the order the indices first use them, dropping unreferenced ones
+    static void ReorderVertices(MeshGeometry& geometry)
+    {
+        List<int> remap = List<int>(geometry.vertices.size(), -1);
+        List<Vec3> reordered;
+        reordered.reserve(geometry.vertices.size());
+        for (size_t i = 0; i < geometry.indices.size(); i++)
+        {
+            int& index = geometry.indices[i];
+            if (remap[index] < 0)
+            {
+                remap[index] = (int)reordered.size();
+                reordered.emplace_back(geometry.vertices[index]);
+            }
+            index = remap[index];
+        }
+        geometry.vertices.swap(reordered);
+    }
+
+    // Average cache misses per triangle through a FIFO vertex cache of the given size
+    static float ACMR(const List<int>& indices, const int& cacheSize)
+    {
+        if (indices.size() < 3) {
+            return 0;
+        }
+        List<int> fifo = List<int>(cacheSize, -1);
+        size_t head = 0;
+        size_t misses = 0;
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            if (std::find(fifo.begin(), fifo.end(), indices[i]) == fifo.end())
+            {
+                fifo[head] = indices[i];
+                head = (head + 1) % cacheSize;
+                misses++;
+            }
+        }
+        return (float)misses / (float)(indices.size() / 3);
+    }
+};
+bool MeshOptimizer::enabled = true;
+float MeshOptimizer::weldEpsilon = 0.00001f;
+int MeshOptimizer::cacheSize = 32;
+
+#endif
@@ -0,0 +1,385 @@
+#pragma once
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+#include <Graphics.h>
+#include <MeshOptimizer.h>
+#include <queue>
+#include <unordered_map>
+#include <cstdint>
+#include <math.h>
+/*
+    Quadric error metric edge collapse (Garland & Heckbert), used to build each asset's LOD chain at load time.
+    - Every vertex sums the plane quadrics of its triangles (weighted by area). Collapsing an edge moves both ends to
+      the point with the least squared distance to all those planes, and the cheapest collapse always goes first.
+    - Open borders and edges between differently colored triangles also get a plane perpendicular to the triangle,
+      so silhouettes and material regions keep their outline.
+    - A collapse that would flip one of the surrounding triangles is skipped.
+    Each level is simplified from the previous one to lodRatio of its triangles (MeshGeometry::lods), and reordered
+    with MeshOptimizer like the full mesh.
+*/
+
+struct Quadric
+{
+    // Upper triangle of the symmetric 4x4 plane matrix
+    double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+    Quadric() {}
+
+    // Squared distance to the plane ax + by + cz + d = 0 (unit normal), times weight
+    Quadric(const double& a, const double& b, const double& c, const double& d, const double& weight)
+    {
+        a2 = a * a * weight; ab = a * b * weight; ac = a * c * weight; ad = a * d * weight;
+        b2 = b * b * weight; bc = b * c * weight; bd = b * d * weight;
+        c2 = c * c * weight; cd = c * d * weight;
+        d2 = d * d * weight;
+    }
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        return *this;
+    }
+
+    double Error(const double& x, const double& y, const double& z) const
+    {
+        return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+            + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+            + c2 * z * z + 2 * cd * z
+            + d2;
+    }
+
+    // Point of least error. False if the quadric is (nearly) singular, e.g. all planes parallel.
+    bool Minimum(double& x, double& y, double& z) const
+    {
+        double det = a2 * (b2 * c2 - bc * bc) - ab * (ab * c2 - bc * ac) + ac * (ab * bc - b2 * ac);
+        double scale = a2 + b2 + c2;
+        if (fabs(det) <= 1e-9 * scale * scale * scale) {
+            return false;
+        }
+        double invDet = 1.0 / det;
+        // Cramer's rule on A * p = -(ad, bd, cd)
+        x = -(ad * (b2 * c2 - bc * bc) - ab * (bd * c2 - bc * cd) + ac * (bd * bc - b2 * cd)) * invDet;
+        y = -(a2 * (bd * c2 - cd * bc) - ad * (ab * c2 - bc * ac) + ac * (ab * cd - bd * ac)) * invDet;
+        z = -(a2 * (b2 * cd - bc * bd) - ab * (ab * cd - bd * ac) + ad * (ab * bc - b2 * ac)) * invDet;
+        return true;
+    }
+};
+
+Quadric operator+(const Quadric& a, const Quadric& b)
+{
+    Quadric q = a;
+    q += b;
+    return q;
+}
+
+struct MeshSimplifier
+{
+    static int lodLevels;// Levels after the full mesh
+    static float lodRatio;// Triangles of each level relative to the one before
+    static size_t minTriangles;// Smallest level worth keeping
+    static float borderWeight;
+
+    // Fills geometry.lods. Call on optimized, built geometry.
+    static void BuildLODs(MeshGeometry& geometry)
+    {
+        geometry.lods.clear();
+        MeshGeometry* previous = &geometry;
+        for (int level = 0; level < lodLevels; level++)
+        {
+            size_t triangleCount = previous->indices.size() / 3;
+            size_t target = (size_t)(triangleCount * lodRatio);
+            if (target < minTriangles) {
+                break;
+            }
+
+            std::shared_ptr<MeshGeometry> lod = std::make_shared<MeshGeometry>();
+            Simplify(*previous, *lod, target);
+            // Mostly locked borders, a level this close to the previous one isn't worth drawing
+            if (lod->indices.size() / 3 > triangleCount * (1 + lodRatio) / 2) {
+                break;
+            }
+            MeshOptimizer::Reorder(*lod);
+            lod->Build();
+            geometry.lods.emplace_back(lod);
+            previous = lod.get();
+        }
+    }
+
+    struct Collapse
+    {
+        double cost;
+        int a;
+        int b;
+        uint32_t versionA;
+        uint32_t versionB;
+        Vec3 position;
+
+        bool operator>(const Collapse& other) const { return cost > other.cost; }
+    };
+
+    static uint64_t EdgeKey(int a, int b)
+    {
+        return a < b ? ((uint64_t)a << 32) | (uint32_t)b : ((uint64_t)b << 32) | (uint32_t)a;
+    }
+
+    // Collapses edges of source (vertices, indices, triangle colors) until targetTriangles remain or nothing more
+    // can go. result gets the compacted vertices/indices/colors, not built.
+    static void Simplify(const MeshGeometry& source, MeshGeometry& result, const size_t& targetTriangles)
+    {
+        List<Vec3> positions = source.vertices;
+        List<int> indices = source.indices;
+        size_t vertexCount = positions.size();
+        size_t triangleCount = indices.size() / 3;
+
+        List<Quadric> quadrics = List<Quadric>(vertexCount);
+        List<List<int>> vertexTriangles = List<List<int>>(vertexCount);
+        List<char> triangleRemoved = List<char>(triangleCount, 0);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            Vec3& p0 = positions[indices[t * 3]];
+            Vec3& p1 = positions[indices[t * 3 + 1]];
+            Vec3& p2 = positions[indices[t * 3 + 2]];
+            Vec3 normal = CrossProduct(p1 - p0, p2 - p0);
+            double length = normal.Magnitude();
+            if (length > 0)
+            {
+                double a = normal.x / length, b = normal.y / length, c = normal.z / length;
+                Quadric plane = Quadric(a, b, c, -(a * p0.x + b * p0.y + c * p0.z), length * 0.5);
+                for (int k = 0; k < 3; k++) {
+                    quadrics[indices[t * 3 + k]] += plane;
+                }
+            }
+            for (int k = 0; k < 3; k++) {
+                vertexTriangles[indices[t * 3 + k]].emplace_back((int)t);
+            }
+        }
+
+        // Edges: how many triangles share each, and whether their colors differ
+        struct Edge
+        {
+            int triangle;
+            int count;
+            bool materialBorder;
+        };
+        std::unordered_map<uint64_t, Edge> edges;
+        edges.reserve(triangleCount * 2);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                auto inserted = edges.emplace(EdgeKey(indices[t * 3 + k], indices[t * 3 + (k + 1) % 3]), Edge{ (int)t, 1, false });
+                if (!inserted.second)
+                {
+                    Edge& edge = inserted.first->second;
+                    edge.count++;
+                    const Color& c1 = source.triangles[edge.triangle].color;
+                    const Color& c2 = source.triangles[t].color;
+                    edge.materialBorder = edge.materialBorder || c1.r != c2.r || c1.g != c2.g || c1.b != c2.b || c1.a != c2.a;
+                }
+            }
+        }
+        for (auto it = edges.begin(); it != edges.end(); it++)
+        {
+            Edge& edge = it->second;
+            if (edge.count != 1 && !edge.materialBorder) {
+                continue;
+            }
+            int a = (int)(it->first >> 32);
+            int b = (int)(it->first & 0xFFFFFFFF);
+            int t = edge.triangle;
+            Vec3& p0 = positions[indices[t * 3]];
+            Vec3& p1 = positions[indices[t * 3 + 1]];
+            Vec3& p2 = positions[indices[t * 3 + 2]];
+            Vec3 edgeVector = positions[b] - positions[a];
+            Vec3 borderNormal = CrossProduct(edgeVector, CrossProduct(p1 - p0, p2 - p0));
+            double length = borderNormal.Magnitude();
+            if (length == 0) {
+                continue;
+            }
+            double nx = borderNormal.x / length, ny = borderNormal.y / length, nz = borderNormal.z / length;
+            Quadric border = Quadric(nx, ny, nz, -(nx * positions[a].x + ny * positions[a].y + nz * positions[a].z),
+                borderWeight * edgeVector.SqrMagnitude());
+            quadrics[a] += border;
+            quadrics[b] += border;
+        }
+
+        List<uint32_t> version = List<uint32_t>(vertexCount, 0);
+        List<char> vertexRemoved = List<char>(vertexCount, 0);
+        std::priority_queue<Collapse, List<Collapse>, std::greater<Collapse>> heap;
+        for (auto it = edges.begin(); it != edges.end(); it++) {
+            heap.push(Candidate((int)(it->first >> 32), (int)(it->first & 0xFFFFFFFF), positions, quadrics, version));
+        }
+
+        size_t live = triangleCount;
+        while (live > targetTriangles && !heap.empty())
+        {
+            Collapse collapse = heap.top();
+            heap.pop();
+            int a = collapse.a;
+            int b = collapse.b;
+            // Stale: one end was collapsed or moved since this was queued
+            if (vertexRemoved[a] || vertexRemoved[b] || version[a] != collapse.versionA || version[b] != collapse.versionB) {
+                continue;
+            }
+            if (Flips(a, b, collapse.position, positions, indices, vertexTriangles, triangleRemoved) ||
+                Flips(b, a, collapse.position, positions, indices, vertexTriangles, triangleRemoved)) {
+                continue;
+            }
+
+            // b merges into a
+            positions[a] = collapse.position;
+            quadrics[a] += quadrics[b];
+            vertexRemoved[b] = 1;
+            version[a]++;
+            for (size_t i = 0; i < vertexTriangles[b].size(); i++)
+            {
+                int t = vertexTriangles[b][i];
+                if (triangleRemoved[t]) {
+                    continue;
+                }
+                int* corners = &indices[t * 3];
+                if (corners[0] == a || corners[1] == a || corners[2] == a)
+                {
+                    triangleRemoved[t] = 1;
+                    live--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++)
+                {
+                    if (corners[k] == b) {
+                        corners[k] = a;
+                    }
+                }
+                vertexTriangles[a].emplace_back(t);
+            }
+            vertexTriangles[b].clear();
+
+            List<int>& around = vertexTriangles[a];
+            size_t kept = 0;
+            for (size_t i = 0; i < around.size(); i++)
+            {
+                if (!triangleRemoved[around[i]]) {
+                    around[kept++] = around[i];
+                }
+            }
+            around.resize(kept);
+
+            for (size_t i = 0; i < around.size(); i++)
+            {
+                int* corners = &indices[around[i] * 3];
+                for (int k = 0; k < 3; k++)
+                {
+                    if (corners[k] != a) {
+                        heap.push(Candidate(a, corners[k], positions, quadrics, version));
+                    }
+                }
+            }
+        }
+
+        // Compact what's left
+        List<int> remap = List<int>(vertexCount, -1);
+        result.vertices.clear();
+        result.indices.clear();
+        result.triangles.clear();
+        result.indices.reserve(live * 3);
+        result.triangles.reserve(live);
+        for (size_t t = 0; t < triangleCount; t++)
+        {
+            if (triangleRemoved[t]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                int v = indices[t * 3 + k];
+                if (remap[v] < 0)
+                {
+                    remap[v] = (int)result.vertices.size();
+                    result.vertices.emplace_back(positions[v]);
+                }
+                result.indices.emplace_back(remap[v]);
+            }
+            result.triangles.emplace_back();
+            result.triangles.back().color = source.triangles[t].color;
+        }
+    }
+
+    static Collapse Candidate(const int& a, const int& b, List<Vec3>& positions, List<Quadric>& quadrics, List<uint32_t>& version)
+    {
+        Quadric q = quadrics[a] + quadrics[b];
+        Collapse collapse;
+        collapse.a = a;
+        collapse.b = b;
+        collapse.versionA = version[a];
+        collapse.versionB = version[b];
+
+        Vec3& pa = positions[a];
+        Vec3& pb = positions[b];
+        double x, y, z;
+        // An ill conditioned quadric can put its minimum far off the edge, that counts as singular too
+        Vec3 middle = (pa + pb) * 0.5;
+        if (q.Minimum(x, y, z) && (Vec3(x, y, z) - middle).SqrMagnitude() <= (pb - pa).SqrMagnitude())
+        {
+            collapse.position = Vec3(x, y, z);
+            collapse.cost = q.Error(x, y, z);
+        }
+        else
+        {
+            // Flat or degenerate neighbourhood: best of the two ends and the middle
+            Vec3 options[3] = { pa, pb, middle };
+            collapse.cost = INFINITY;
+            for (int i = 0; i < 3; i++)
+            {
+                double cost = q.Error(options[i].x, options[i].y, options[i].z);
+                if (cost < collapse.cost)
+                {
+                    collapse.cost = cost;
+                    collapse.position = options[i];
+                }
+            }
+        }
+        if (collapse.cost < 0) {
+            collapse.cost = 0;
+        }
+        return collapse;
+    }
+
+    // Would moving vertex to position turn any of its triangles (other than those shared with other) over?
+    static bool Flips(const int& vertex, const int& other, Vec3& position, List<Vec3>& positions, List<int>& indices,
+        List<List<int>>& vertexTriangles, List<char>& triangleRemoved)
+    {
+        List<int>& around = vertexTriangles[vertex];
+        for (size_t i = 0; i < around.size(); i++)
+        {
+            int t = around[i];
+            if (triangleRemoved[t]) {
+                continue;
+            }
+            int* corners = &indices[t * 3];
+            if (corners[0] == other || corners[1] == other || corners[2] == other) {
+                continue;
+            }
+            Vec3 p[3];
+            Vec3 moved[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = positions[corners[k]];
+                moved[k] = corners[k] == vertex ? position : p[k];
+            }
+            Vec3 before = CrossProduct(p[1] - p[0], p[2] - p[0]);
+            Vec3 after = CrossProduct(moved[1] - moved[0], moved[2] - moved[0]);
+            if (DotProduct(before, after) <= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+int MeshSimplifier::lodLevels = 3;
+float MeshSimplifier::lodRatio = 0.35f;
+size_t MeshSimplifier::minTriangles = 128;
+float MeshSimplifier::borderWeight = 10.0f;
+
+#endif
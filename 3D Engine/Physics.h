@@ -49,12 +49,13 @@ bool Physics::gravity = false;
 bool Physics::octTree = true;
 
 double deltaTime = 0;
+double fixedDeltaTime = 0;// > 0: each frame advances by exactly this instead of the clock (headless rendering)
 int fps = 0;
 
 void Time()
 {
     static double prevTime = 0;
-    double currentTime = glfwGetTime();
+    double currentTime = fixedDeltaTime > 0 ? prevTime + fixedDeltaTime : glfwGetTime();
     deltaTime = currentTime - prevTime;
     prevTime = currentTime;
 
@@ -107,9 +108,9 @@ public:
         delete mesh;
     }
 
-    List<Triangle>* MapVertsToTriangles()
+    const List<Triangle>& Triangles()
     {
-        return mesh->MapVertsToTriangles();
+        return mesh->Triangles();
     }
 
     List<Vec3> WorldVertices()
@@ -117,9 +118,9 @@ public:
         return mesh->WorldVertices();
     }
 
-    List<Vec3> Vertices()
+    const List<Vec3>& Vertices()
     {
-        return mesh->vertices;
+        return mesh->Vertices();
     }
 };
 
@@ -861,7 +862,7 @@ public:
         return direction;
     }
 
-    Matrix4x4 WorldToRaySpaceMatrix()
+    Matrix3x4 WorldToRaySpaceMatrix()
     {
         return transform.TRInverse();
     }
@@ -871,14 +872,14 @@ template <typename T>
 struct RaycastInfo
 {
     T* objectHit = nullptr;
-    Triangle* triangleHit = nullptr;
+    int triangleIndex = -1;// Into the hit mesh's Triangles()
     Triangle triangleHit_w = Triangle();
     Vec3 contactPoint = Vec3::zero;
     RaycastInfo() {};
-    RaycastInfo(T* objHit, Triangle* triHit, Vec3& contactPoint, Triangle& worldSpaceTri)
+    RaycastInfo(T* objHit, int triIndex, Vec3& contactPoint, Triangle& worldSpaceTri)
     {
         this->objectHit = objHit;
-        this->triangleHit = triHit;
+        this->triangleIndex = triIndex;
         this->contactPoint = contactPoint;
         this->triangleHit_w = worldSpaceTri;
     }
@@ -895,12 +896,23 @@ bool Raycast(Ray& ray, RaycastInfo<T>& raycastInfo, const std::function<void(Ray
     {
         auto obj = ManagedObjectPool<T>::objects[i];
 
-        List<Triangle>* triangles = obj->MapVertsToTriangles();
-        for (size_t j = 0; j < triangles->size(); j++)
+        // Gather the triangle corners and move them to world space in one batch per object.
+        static List<Vec3> worldVerts;
+        const List<Triangle>& triangles = obj->Triangles();
+        worldVerts.resize(triangles.size() * 3);
+        for (size_t j = 0; j < triangles.size(); j++)
         {
-            Triangle worldSpaceTri = (*triangles)[j];
             for (size_t k = 0; k < 3; k++) {
-                worldSpaceTri.verts[k] = obj->TRS() * worldSpaceTri.verts[k];
+                worldVerts[j * 3 + k] = triangles[j].verts[k];
+            }
+        }
+        TransformPoints(obj->TRS(), worldVerts.data(), worldVerts.data(), worldVerts.size());
+
+        for (size_t j = 0; j < triangles.size(); j++)
+        {
+            Triangle worldSpaceTri = triangles[j];
+            for (size_t k = 0; k < 3; k++) {
+                worldSpaceTri.verts[k] = worldVerts[j * 3 + k];
             }
             //------------------Ray casting (World & Ray Space)--------------------------
             Vec3 pointOfIntersection;
@@ -912,13 +924,12 @@ bool Raycast(Ray& ray, RaycastInfo<T>& raycastInfo, const std::function<void(Ray
                     if (Graphics::debugRaycasting) {
                         Line::AddWorldLine(Line(from, to, Color::red));
                     }
-                    Matrix4x4 worldToRaySpaceMatrix = ray.WorldToRaySpaceMatrix();
+                    Matrix3x4 worldToRaySpaceMatrix = ray.WorldToRaySpaceMatrix();
                     Vec3 pointOfIntersection_v = worldToRaySpaceMatrix * pointOfIntersection;
-                    Triangle* viewSpaceTri = &((*triangles)[j]);
-                    for (size_t k = 0; k < 3; k++) {
-                        viewSpaceTri->verts[k] = worldToRaySpaceMatrix * worldSpaceTri.verts[k];
-                    }
-                    if (PointInsideTriangle(pointOfIntersection_v, viewSpaceTri->verts))
+                    // Local copy, the model space triangles are shared by every mesh using this asset
+                    Triangle viewSpaceTri = worldSpaceTri;
+                    TransformPoints(worldToRaySpaceMatrix, worldSpaceTri.verts, viewSpaceTri.verts, 3);
+                    if (PointInsideTriangle(pointOfIntersection_v, viewSpaceTri.verts))
                     {
                         // Check if within range
                         float sqrDist = (pointOfIntersection - from).SqrMagnitude();
@@ -928,7 +939,7 @@ bool Raycast(Ray& ray, RaycastInfo<T>& raycastInfo, const std::function<void(Ray
 
                             raycastInfo.objectHit = obj;
                             raycastInfo.contactPoint = pointOfIntersection;
-                            raycastInfo.triangleHit = &(*triangles)[j];
+                            raycastInfo.triangleIndex = (int)j;
                             raycastInfo.triangleHit_w = worldSpaceTri;
 
                             if (callback) {
@@ -1032,7 +1043,7 @@ static void Physics()
             Line::AddWorldLine(Line(ray1.StartPosition(), ray1.EndPosition(), Color::green, 3));
             Point::AddWorldPoint(Point(info.contactPoint, Color::green, 7));
             //info.objectHit->SetColor(Color::purple);
-            info.triangleHit->color = Color::purple;//Color::Random();
+            info.objectHit->SetTriangleColor(info.triangleIndex, Color::purple);//Color::Random();
         }
         /*
         Ray ray2 = Ray(Camera::cameras[2]->Position(), Camera::cameras[2]->Forward(), 50);
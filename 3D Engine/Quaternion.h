@@ -0,0 +1,242 @@
+#pragma once
+#ifndef QUATERNION_H
+#define QUATERNION_H
+#include <Matrix.h>
+#include <math.h>
+/*
+    Unit quaternions for rotations. Same conventions as Matrix.h (right-handed, intrinsic), so
+    Quaternion::RotX(t).ToMatrix() == Matrix3x3::RotX(t) and q1 * q2 matches R1 * R2 (q2 applied first).
+    ===============[ Why ]================
+    - Composing two rotations is 16 multiplies instead of 27 for a 3x3.
+    - Repeated composition drifts off unit length instead of off orthonormal, and Normalize() fixes that with a couple of
+      multiplies instead of a Gram-Schmidt pass.
+    - Slerp() interpolates at constant angular speed.
+    EXAMPLES:
+    --------------------------------------------------------------------------------------------------
+    SPIN AROUND Y EVERY FRAME:
+        orientation = Quaternion::RotY(speed * deltaTime) * orientation;
+    --------------------------------------------------------------------------------------------------
+    HALFWAY BETWEEN TWO ORIENTATIONS:
+        Quaternion mid = Quaternion::Slerp(a, b, 0.5);
+    --------------------------------------------------------------------------------------------------
+*/
+
+class Quaternion
+{
+public:
+    float w = 1;
+    float x = 0;
+    float y = 0;
+    float z = 0;
+
+    static const Quaternion identity;
+
+    Quaternion() {}
+
+    Quaternion(const float& w, const float& x, const float& y, const float& z)
+    {
+        this->w = w;
+        this->x = x;
+        this->y = y;
+        this->z = z;
+    }
+
+    // Rotation of angle radians about a unit length axis
+    static Quaternion AxisAngle(const Vec3& axis, const float& angle)
+    {
+        float s = sin(angle * 0.5f);
+        return Quaternion(cos(angle * 0.5f), axis.x * s, axis.y * s, axis.z * s);
+    }
+
+    static Quaternion RotX(const float& theta) { return Quaternion(cos(theta * 0.5f), sin(theta * 0.5f), 0, 0); }
+
+    static Quaternion RotY(const float& theta) { return Quaternion(cos(theta * 0.5f), 0, sin(theta * 0.5f), 0); }
+
+    static Quaternion RotZ(const float& theta) { return Quaternion(cos(theta * 0.5f), 0, 0, sin(theta * 0.5f)); }
+
+    // Same rotation as YPR(roll, pitch, yaw)
+    static Quaternion YPR(const float& roll, const float& pitch, const float& yaw)
+    {
+        return Multiply(Multiply(RotZ(yaw), RotY(pitch)), RotX(roll));
+    }
+
+    // Expects an orthonormal rotation matrix (no scale)
+    static Quaternion FromMatrix(const Matrix3x3& matrix)
+    {
+        const float(&m)[3][3] = matrix.m;
+        float trace = m[0][0] + m[1][1] + m[2][2];
+        Quaternion q;
+        // Branch on the largest diagonal term to keep the square root away from 0
+        if (trace > 0)
+        {
+            float s = 0.5f / sqrt(trace + 1.0f);
+            q.w = 0.25f / s;
+            q.x = (m[2][1] - m[1][2]) * s;
+            q.y = (m[0][2] - m[2][0]) * s;
+            q.z = (m[1][0] - m[0][1]) * s;
+        }
+        else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+        {
+            float s = 2.0f * sqrt(1.0f + m[0][0] - m[1][1] - m[2][2]);
+            q.w = (m[2][1] - m[1][2]) / s;
+            q.x = 0.25f * s;
+            q.y = (m[0][1] + m[1][0]) / s;
+            q.z = (m[0][2] + m[2][0]) / s;
+        }
+        else if (m[1][1] > m[2][2])
+        {
+            float s = 2.0f * sqrt(1.0f + m[1][1] - m[0][0] - m[2][2]);
+            q.w = (m[0][2] - m[2][0]) / s;
+            q.x = (m[0][1] + m[1][0]) / s;
+            q.y = 0.25f * s;
+            q.z = (m[1][2] + m[2][1]) / s;
+        }
+        else
+        {
+            float s = 2.0f * sqrt(1.0f + m[2][2] - m[0][0] - m[1][1]);
+            q.w = (m[1][0] - m[0][1]) / s;
+            q.x = (m[0][2] + m[2][0]) / s;
+            q.y = (m[1][2] + m[2][1]) / s;
+            q.z = 0.25f * s;
+        }
+        q.Normalize();
+        return q;
+    }
+
+    Matrix3x3 ToMatrix() const
+    {
+        float xx = x * x, yy = y * y, zz = z * z;
+        float xy = x * y, xz = x * z, yz = y * z;
+        float wx = w * x, wy = w * y, wz = w * z;
+
+        float matrix[3][3] = {
+            {1 - 2 * (yy + zz), 2 * (xy - wz), 2 * (xz + wy)},
+            {2 * (xy + wz), 1 - 2 * (xx + zz), 2 * (yz - wx)},
+            {2 * (xz - wy), 2 * (yz + wx), 1 - 2 * (xx + yy)}
+        };
+
+        return matrix;
+    }
+
+    static float Dot(const Quaternion& a, const Quaternion& b)
+    {
+        return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    // For unit quaternions this is the inverse rotation
+    Quaternion Conjugate() const { return Quaternion(w, -x, -y, -z); }
+
+    // Brings the length back to 1. Drift from composing unit quaternions is tiny, so one Newton step on 1/sqrt
+    // is enough there; anything further off gets the exact division.
+    Quaternion& Normalize()
+    {
+        float lengthSqr = Dot(*this, *this);
+        float scale;
+        if (fabs(lengthSqr - 1.0f) < 0.01f) {
+            scale = (3.0f - lengthSqr) * 0.5f;
+        }
+        else if (lengthSqr > 0) {
+            scale = 1.0f / sqrt(lengthSqr);
+        }
+        else {
+            *this = Quaternion();
+            return *this;
+        }
+        w *= scale;
+        x *= scale;
+        y *= scale;
+        z *= scale;
+        return *this;
+    }
+
+    Quaternion Normalized() const
+    {
+        Quaternion q = *this;
+        return q.Normalize();
+    }
+
+    // Hamilton product: applies b first, then a (same as matrixA * matrixB)
+    static Quaternion Multiply(const Quaternion& a, const Quaternion& b)
+    {
+        return Quaternion(
+            a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z,
+            a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+            a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+            a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w);
+    }
+
+    // Same as a = a * b, where b is applied first (intrinsic, like Matrix3x3 *=)
+    Quaternion& operator*=(const Quaternion& b)
+    {
+        *this = Multiply(*this, b);
+        return *this;
+    }
+
+    // Spherical linear interpolation along the shortest arc, t in [0, 1]
+    static Quaternion Slerp(const Quaternion& a, const Quaternion& b, const float& t)
+    {
+        Quaternion end = b;
+        float cosTheta = Dot(a, b);
+        if (cosTheta < 0)
+        {
+            cosTheta = -cosTheta;
+            end = Quaternion(-b.w, -b.x, -b.y, -b.z);
+        }
+
+        float wa, wb;
+        if (cosTheta > 0.9995f)
+        {
+            // Nearly parallel, sin(theta) ~ 0. Lerp and renormalize.
+            wa = 1.0f - t;
+            wb = t;
+        }
+        else
+        {
+            float theta = acos(cosTheta);
+            float invSin = 1.0f / sin(theta);
+            wa = sin((1.0f - t) * theta) * invSin;
+            wb = sin(t * theta) * invSin;
+        }
+
+        Quaternion result = Quaternion(
+            wa * a.w + wb * end.w,
+            wa * a.x + wb * end.x,
+            wa * a.y + wb * end.y,
+            wa * a.z + wb * end.z);
+        return result.Normalize();
+    }
+
+    // Angle (radians) and unit axis of the rotation
+    void ToAxisAngle(Vec3& axis, float& angle) const
+    {
+        float clampedW = w > 1 ? 1 : (w < -1 ? -1 : w);
+        angle = 2.0f * acos(clampedW);
+        float s = sqrt(1.0f - clampedW * clampedW);
+        if (s < 0.0001f) {
+            axis = Vec3(1, 0, 0);
+        }
+        else {
+            axis = Vec3(x / s, y / s, z / s);
+        }
+    }
+};
+const Quaternion Quaternion::identity = Quaternion();
+
+Quaternion operator*(const Quaternion& a, const Quaternion& b)
+{
+    return Quaternion::Multiply(a, b);
+}
+
+// Rotates v. v' = v + 2w(q x v) + 2q x (q x v)
+Vec3 operator*(const Quaternion& q, const Vec3& v)
+{
+    float tx = 2.0f * (q.y * v.z - q.z * v.y);
+    float ty = 2.0f * (q.z * v.x - q.x * v.z);
+    float tz = 2.0f * (q.x * v.y - q.y * v.x);
+    return Vec3(
+        v.x + q.w * tx + (q.y * tz - q.z * ty),
+        v.y + q.w * ty + (q.z * tx - q.x * tz),
+        v.z + q.w * tz + (q.x * ty - q.y * tx));
+}
+
+#endif
@@ -0,0 +1,479 @@
+#pragma once
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+#include <Utility.h>
+#include <Matrix.h>
+#include <ThreadPool.h>
+#include <algorithm>
+#include <cstdint>
+#include <cfloat>
+#include <string>
+#include <stdio.h>
+// The triangle kernel does 8 pixels at a time with AVX2 (/arch:AVX2 or -mavx2), one at a time otherwise.
+#if !defined(MATRIX_NO_SIMD) && defined(__AVX2__)
+#define RASTERIZER_AVX2
+#include <immintrin.h>
+#endif
+/*
+    CPU backend for the Graphics draw calls (Graphics::software), so frames can be drawn and saved without a window or GPU.
+    - Coordinates come in as the GL calls get them: x, y in -1..1 with y up. Pixel (0, 0) is the top left.
+    - Color buffer: RGBA8, red in the low byte. Depth buffer: one float per pixel, bigger is closer.
+    - Triangles: corners snapped to 1/16 pixel, integer edge functions sampled at pixel centers, with the top-left rule
+      so triangles sharing an edge don't both cover its pixels. Depth is a float plane over the triangle, so it must be
+      a value that is linear in screen space (1/distance in perspective).
+    - Lines and points are squares of lineWidth/pointSize pixels and don't use the depth buffer.
+    - FillTriangles() draws a whole list at once: triangles are binned to tileSize x tileSize screen tiles (in chunks
+      on the ThreadPool, each chunk with its own bins), then tiles are rasterized in parallel. A tile only writes its
+      own pixels of the color and depth buffers, so no locks are needed, and walks the chunks' bins in order, so
+      submission order (the painter's order without depth test) is kept per pixel.
+    Edge functions are exact integers and depth is evaluated from each pixel's position rather than stepped, so a
+    triangle covers the same pixels with the same depth whichever tile or bounding box it's drawn through.
+*/
+
+struct Rasterizer
+{
+    static int width;
+    static int height;
+    static List<uint32_t> colorBuffer;
+    static List<float> depthBuffer;
+    static bool depthTest;// Filled triangles with a depth are tested and written (replaces the painter's sort)
+    static uint32_t drawColor;
+    static int lineWidth;
+    static int pointSize;
+    static bool binning;// TriangleBuffer draws through FillTriangles() (otherwise one FillTriangle() at a time)
+    static bool simd;// Triangles are filled 8 pixels at a time when built with AVX2 (otherwise one at a time)
+    static const int tileSize = 64;
+    static const int subPixelBits = 4;// Corners are snapped to 1/16 pixel
+    static const int subPixels = 1 << subPixelBits;
+    static constexpr float guardBand = 65536;// Pixels
+
+    // FillTriangles() working set: corners in pixels, and per binning chunk, per tile, the triangles touching it
+    static List<float> setupX[3];
+    static List<float> setupY[3];
+    static List<List<List<uint32_t>>> bins;
+
+    static void Resize(const int& w, const int& h)
+    {
+        width = w;
+        height = h;
+        colorBuffer.assign((size_t)w * h, 0);
+        depthBuffer.assign((size_t)w * h, -FLT_MAX);
+    }
+
+    static void Clear(const uint32_t& color = 0xFF000000)
+    {
+        std::fill(colorBuffer.begin(), colorBuffer.end(), color);
+        std::fill(depthBuffer.begin(), depthBuffer.end(), -FLT_MAX);
+    }
+
+    static uint32_t Pack(const float& r, const float& g, const float& b, const float& a = 255)
+    {
+        return (uint32_t)Clamp(r, 0, 255) | ((uint32_t)Clamp(g, 0, 255) << 8) |
+            ((uint32_t)Clamp(b, 0, 255) << 16) | ((uint32_t)Clamp(a, 0, 255) << 24);
+    }
+
+    static float PixelX(const float& x)
+    {
+        return (x + 1.0f) * 0.5f * width;
+    }
+
+    static float PixelY(const float& y)
+    {
+        return (1.0f - y) * 0.5f * height;
+    }
+
+    // Edge a->b on a triangle with positive area (y down): top edges run right, left edges run up
+    static bool TopLeft(const int64_t& ax, const int64_t& ay, const int64_t& bx, const int64_t& by)
+    {
+        return (ay == by && bx > ax) || by < ay;
+    }
+
+    static void FillTriangle(const Vec2& p1, const Vec2& p2, const Vec2& p3)
+    {
+        FillTriangle(p1, p2, p3, 0, 0, 0, false);
+    }
+
+    static void FillTriangle(const Vec2& p1, const Vec2& p2, const Vec2& p3, float z1, float z2, float z3, bool useDepth = true)
+    {
+        Rasterize(PixelX(p1.x), PixelY(p1.y), PixelX(p2.x), PixelY(p2.y), PixelX(p3.x), PixelY(p3.y),
+            z1, z2, z3, drawColor, useDepth && depthTest, 0, 0, width - 1, height - 1);
+    }
+
+    // Sutherland-Hodgman against |x|, |y| <= guardBand (slightly inside, so the result passes the test). Depth is
+    // linear in screen space, so it's interpolated like x and y. Returns the corner count (up to 3 + 4 + 2).
+    static int ClipToGuardBand(float (&polygon)[9][3], int count)
+    {
+        const float limit = guardBand * 0.5f;
+        float clipped[9][3];
+        for (int plane = 0; plane < 4 && count > 0; plane++)
+        {
+            int axis = plane / 2;
+            float sign = (plane % 2 == 0) ? 1.0f : -1.0f;
+            int out = 0;
+            for (int i = 0; i < count; i++)
+            {
+                float* a = polygon[i];
+                float* b = polygon[(i + 1) % count];
+                float da = limit - sign * a[axis];
+                float db = limit - sign * b[axis];
+                if (da >= 0) {
+                    std::copy(a, a + 3, clipped[out++]);
+                }
+                if ((da >= 0) != (db >= 0))
+                {
+                    float t = da / (da - db);
+                    for (int k = 0; k < 3; k++) {
+                        clipped[out][k] = a[k] + (b[k] - a[k]) * t;
+                    }
+                    out++;
+                }
+            }
+            count = out;
+            for (int i = 0; i < count; i++) {
+                std::copy(clipped[i], clipped[i] + 3, polygon[i]);
+            }
+        }
+        return count;
+    }
+
+    // Pixel coordinates, only pixels inside [clipMinX, clipMaxX] x [clipMinY, clipMaxY] are touched
+    static void Rasterize(float x1, float y1, float x2, float y2, float x3, float y3, float z1, float z2, float z3,
+        const uint32_t& color, const bool& depth, const int& clipMinX, const int& clipMinY, const int& clipMaxX, const int& clipMaxY)
+    {
+        // Corners are snapped to the sub-pixel grid. Beyond the guard band the edge steps could overflow the 32 bit
+        // lanes, so those triangles (corners just in front of the near plane) are clipped to it first.
+        if (!(fabs(x1) < guardBand && fabs(y1) < guardBand && fabs(x2) < guardBand &&
+            fabs(y2) < guardBand && fabs(x3) < guardBand && fabs(y3) < guardBand))
+        {
+            float polygon[9][3] = { { x1, y1, z1 }, { x2, y2, z2 }, { x3, y3, z3 } };
+            int count = ClipToGuardBand(polygon, 3);
+            for (int i = 2; i < count; i++)
+            {
+                Rasterize(polygon[0][0], polygon[0][1], polygon[i - 1][0], polygon[i - 1][1], polygon[i][0], polygon[i][1],
+                    polygon[0][2], polygon[i - 1][2], polygon[i][2], color, depth, clipMinX, clipMinY, clipMaxX, clipMaxY);
+            }
+            return;
+        }
+        int64_t X1 = (int64_t)lrintf(x1 * subPixels), Y1 = (int64_t)lrintf(y1 * subPixels);
+        int64_t X2 = (int64_t)lrintf(x2 * subPixels), Y2 = (int64_t)lrintf(y2 * subPixels);
+        int64_t X3 = (int64_t)lrintf(x3 * subPixels), Y3 = (int64_t)lrintf(y3 * subPixels);
+        int64_t area = (X2 - X1) * (Y3 - Y1) - (Y2 - Y1) * (X3 - X1);
+        if (area == 0) {
+            return;
+        }
+        if (area < 0)
+        {
+            std::swap(X2, X3);
+            std::swap(Y2, Y3);
+            std::swap(z2, z3);
+            area = -area;
+        }
+
+        // Pixel x is covered when its center (x * subPixels + subPixels / 2) is inside
+        int minX = std::max((int)(std::min(X1, std::min(X2, X3)) >> subPixelBits), clipMinX);
+        int minY = std::max((int)(std::min(Y1, std::min(Y2, Y3)) >> subPixelBits), clipMinY);
+        int maxX = std::min((int)(std::max(X1, std::max(X2, X3)) >> subPixelBits), clipMaxX);
+        int maxY = std::min((int)(std::max(Y1, std::max(Y2, Y3)) >> subPixelBits), clipMaxY);
+        if (minX > maxX || minY > maxY) {
+            return;
+        }
+
+        // Edge k (opposite corner k) at pixel (x, y): e = c + stepX * x + stepY * y, >= 0 inside. Edges that aren't
+        // top or left are biased by one so a center exactly on them is outside.
+        int64_t edgeA[3] = { Y2 - Y3, Y3 - Y1, Y1 - Y2 };
+        int64_t edgeB[3] = { X3 - X2, X1 - X3, X2 - X1 };
+        int64_t cornerX[3] = { X2, X3, X1 };
+        int64_t cornerY[3] = { Y2, Y3, Y1 };
+        bool topLeft[3] = { TopLeft(X2, Y2, X3, Y3), TopLeft(X3, Y3, X1, Y1), TopLeft(X1, Y1, X2, Y2) };
+        int64_t stepX[3], stepY[3], c[3];
+        for (int k = 0; k < 3; k++)
+        {
+            stepX[k] = edgeA[k] * subPixels;
+            stepY[k] = edgeB[k] * subPixels;
+            int64_t half = subPixels / 2;
+            c[k] = edgeA[k] * (half - cornerX[k]) + edgeB[k] * (half - cornerY[k]) - (topLeft[k] ? 0 : 1);
+        }
+
+        // Depth plane z = z1 + dzdx * (x - x1) + dzdy * (y - y1), from the snapped corners
+        float fx1 = (float)X1 / subPixels, fy1 = (float)Y1 / subPixels;
+        float fx2 = (float)X2 / subPixels, fy2 = (float)Y2 / subPixels;
+        float fx3 = (float)X3 / subPixels, fy3 = (float)Y3 / subPixels;
+        float inverseArea = 1.0f / ((fx2 - fx1) * (fy3 - fy1) - (fy2 - fy1) * (fx3 - fx1));
+        float dzdx = ((fy2 - fy3) * z1 + (fy3 - fy1) * z2 + (fy1 - fy2) * z3) * inverseArea;
+        float dzdy = ((fx3 - fx2) * z1 + (fx1 - fx3) * z2 + (fx2 - fx1) * z3) * inverseArea;
+
+#if defined(RASTERIZER_AVX2)
+        if (simd)
+        {
+            // 8 pixels of a row at a time. The 64 bit edge value of the first pixel is clamped into 32 bits (the sign
+            // over the 8 pixels can't change once it's that far from 0) and the lanes add lane * stepX.
+            const int64_t clampValue = (int64_t)1 << 30;
+            __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+            __m256 laneF = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+            __m256i laneStep[3];
+            for (int k = 0; k < 3; k++) {
+                laneStep[k] = _mm256_mullo_epi32(lane, _mm256_set1_epi32((int32_t)stepX[k]));
+            }
+            __m256 dzdx8 = _mm256_set1_ps(dzdx);
+            __m256i color8 = _mm256_set1_epi32((int32_t)color);
+            for (int y = minY; y <= maxY; y++)
+            {
+                float rowZ = z1 + dzdy * (y + 0.5f - fy1);
+                int64_t row[3];
+                for (int k = 0; k < 3; k++) {
+                    row[k] = c[k] + stepY[k] * y;
+                }
+                size_t rowStart = (size_t)y * width;
+                for (int x = minX; x <= maxX; x += 8)
+                {
+                    __m256i outside = _mm256_setzero_si256();
+                    bool skip = false;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        int64_t e = row[k] + stepX[k] * x;
+                        if (e < -clampValue)
+                        {
+                            skip = true;// Every lane outside this edge
+                            break;
+                        }
+                        __m256i e8 = _mm256_add_epi32(_mm256_set1_epi32((int32_t)std::min(e, clampValue)), laneStep[k]);
+                        outside = _mm256_or_si256(outside, e8);
+                    }
+                    if (skip) {
+                        continue;
+                    }
+                    // Sign bits mark lanes outside an edge, lanes past maxX are dropped too
+                    __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(maxX - x + 1), lane);
+                    __m256i inside = _mm256_andnot_si256(_mm256_srai_epi32(outside, 31), valid);
+                    if (_mm256_testz_si256(inside, inside)) {
+                        continue;
+                    }
+                    size_t pixel = rowStart + x;
+                    if (depth)
+                    {
+                        __m256 z8 = _mm256_add_ps(_mm256_set1_ps(rowZ), _mm256_mul_ps(dzdx8, _mm256_add_ps(_mm256_set1_ps((float)x - fx1), laneF)));
+                        __m256 old = _mm256_maskload_ps(&depthBuffer[pixel], inside);
+                        inside = _mm256_and_si256(inside, _mm256_castps_si256(_mm256_cmp_ps(z8, old, _CMP_GT_OQ)));
+                        _mm256_maskstore_ps(&depthBuffer[pixel], inside, z8);
+                    }
+                    _mm256_maskstore_epi32((int*)&colorBuffer[pixel], inside, color8);
+                }
+            }
+            return;
+        }
+#endif
+        for (int y = minY; y <= maxY; y++)
+        {
+            float rowZ = z1 + dzdy * (y + 0.5f - fy1);
+            int64_t e1 = c[0] + stepY[0] * y + stepX[0] * minX;
+            int64_t e2 = c[1] + stepY[1] * y + stepX[1] * minX;
+            int64_t e3 = c[2] + stepY[2] * y + stepX[2] * minX;
+            size_t pixel = (size_t)y * width + minX;
+            for (int x = minX; x <= maxX; x++, pixel++, e1 += stepX[0], e2 += stepX[1], e3 += stepX[2])
+            {
+                if ((e1 | e2 | e3) < 0) {
+                    continue;
+                }
+                if (depth)
+                {
+                    float z = rowZ + dzdx * ((float)x - fx1 + 0.5f);
+                    if (z <= depthBuffer[pixel]) {
+                        continue;
+                    }
+                    depthBuffer[pixel] = z;
+                }
+                colorBuffer[pixel] = color;
+            }
+        }
+    }
+
+    // count triangles, drawn in order[0..count) (or 0..count when order is null). x, y in -1..1, z = depth per corner.
+    static void FillTriangles(const float* const x[3], const float* const y[3], const float* const z[3],
+        const uint32_t* colors, const uint32_t* order, const size_t& count)
+    {
+        if (count == 0 || width <= 0 || height <= 0) {
+            return;
+        }
+        ThreadPool& pool = ThreadPool::Instance();
+        int tilesX = (width + tileSize - 1) / tileSize;
+        int tilesY = (height + tileSize - 1) / tileSize;
+        size_t tileCount = (size_t)tilesX * tilesY;
+        size_t chunkCount = std::min((size_t)pool.WorkerCount() + 1, (count + 1023) / 1024);
+        size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+
+        for (int k = 0; k < 3; k++) {
+            setupX[k].resize(count);
+            setupY[k].resize(count);
+        }
+        if (bins.size() < chunkCount) {
+            bins.resize(chunkCount);
+        }
+        for (size_t c = 0; c < chunkCount; c++)
+        {
+            bins[c].resize(tileCount);
+            for (size_t t = 0; t < tileCount; t++) {
+                bins[c][t].clear();
+            }
+        }
+
+        // Binning, in draw order. setup[n] is the n-th triangle drawn.
+        pool.ParallelFor(chunkCount, 1, [&](size_t chunkBegin, size_t chunkEnd) {
+            for (size_t c = chunkBegin; c < chunkEnd; c++)
+            {
+                List<List<uint32_t>>& chunkBins = bins[c];
+                size_t end = std::min(count, (c + 1) * chunkSize);
+                for (size_t n = c * chunkSize; n < end; n++)
+                {
+                    uint32_t i = order ? order[n] : (uint32_t)n;
+                    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+                    for (int k = 0; k < 3; k++)
+                    {
+                        float px = PixelX(x[k][i]);
+                        float py = PixelY(y[k][i]);
+                        setupX[k][n] = px;
+                        setupY[k][n] = py;
+                        minX = std::min(minX, px);
+                        maxX = std::max(maxX, px);
+                        minY = std::min(minY, py);
+                        maxY = std::max(maxY, py);
+                    }
+                    if (!(maxX >= 0 && maxY >= 0 && minX < width && minY < height)) {
+                        continue;// Off screen (or NaN)
+                    }
+                    int tileMinX = std::max((int)minX, 0) / tileSize;
+                    int tileMinY = std::max((int)minY, 0) / tileSize;
+                    int tileMaxX = std::min((int)maxX, width - 1) / tileSize;
+                    int tileMaxY = std::min((int)maxY, height - 1) / tileSize;
+                    for (int ty = tileMinY; ty <= tileMaxY; ty++)
+                    {
+                        for (int tx = tileMinX; tx <= tileMaxX; tx++) {
+                            chunkBins[(size_t)ty * tilesX + tx].emplace_back((uint32_t)n);
+                        }
+                    }
+                }
+            }
+        });
+
+        bool depth = depthTest;
+        pool.ParallelFor(tileCount, 1, [&](size_t tileBegin, size_t tileEnd) {
+            for (size_t t = tileBegin; t < tileEnd; t++)
+            {
+                int clipMinX = (int)(t % tilesX) * tileSize;
+                int clipMinY = (int)(t / tilesX) * tileSize;
+                int clipMaxX = std::min(clipMinX + tileSize, width) - 1;
+                int clipMaxY = std::min(clipMinY + tileSize, height) - 1;
+                for (size_t c = 0; c < chunkCount; c++)
+                {
+                    const List<uint32_t>& tileBin = bins[c][t];
+                    for (size_t b = 0; b < tileBin.size(); b++)
+                    {
+                        uint32_t n = tileBin[b];
+                        uint32_t i = order ? order[n] : n;
+                        Rasterize(setupX[0][n], setupY[0][n], setupX[1][n], setupY[1][n], setupX[2][n], setupY[2][n],
+                            z[0][i], z[1][i], z[2][i], colors[i], depth, clipMinX, clipMinY, clipMaxX, clipMaxY);
+                    }
+                }
+            }
+        });
+    }
+
+    // Square of size pixels centered on (x, y) in pixel coordinates
+    static void Plot(const float& x, const float& y, const int& size)
+    {
+        int half = size / 2;
+        int startX = (int)floor(x) - half;
+        int startY = (int)floor(y) - half;
+        for (int py = std::max(startY, 0); py < std::min(startY + size, height); py++)
+        {
+            for (int px = std::max(startX, 0); px < std::min(startX + size, width); px++) {
+                colorBuffer[(size_t)py * width + px] = drawColor;
+            }
+        }
+    }
+
+    static void DrawPoint(const Vec2& point)
+    {
+        Plot(PixelX(point.x), PixelY(point.y), std::max(pointSize, 1));
+    }
+
+    static void DrawLine(const Vec2& from, const Vec2& to)
+    {
+        float x1 = PixelX(from.x), y1 = PixelY(from.y);
+        float x2 = PixelX(to.x), y2 = PixelY(to.y);
+        // Clipped to the screen (plus a pixel) first, so a line to a point far off screen doesn't take millions of steps
+        float t0 = 0, t1 = 1;
+        float dx = x2 - x1, dy = y2 - y1;
+        float p[4] = { -dx, dx, -dy, dy };
+        float q[4] = { x1 + 1, width + 1 - x1, y1 + 1, height + 1 - y1 };
+        for (int i = 0; i < 4; i++)
+        {
+            if (p[i] == 0)
+            {
+                if (q[i] < 0) {
+                    return;
+                }
+                continue;
+            }
+            float t = q[i] / p[i];
+            if (p[i] < 0) {
+                t0 = std::max(t0, t);
+            }
+            else {
+                t1 = std::min(t1, t);
+            }
+        }
+        if (t0 > t1 || t0 != t0 || t1 != t1) {
+            return;
+        }
+        x2 = x1 + dx * t1;
+        y2 = y1 + dy * t1;
+        x1 = x1 + dx * t0;
+        y1 = y1 + dy * t0;
+
+        int steps = (int)std::max(fabs(x2 - x1), fabs(y2 - y1));
+        float stepX = steps > 0 ? (x2 - x1) / steps : 0;
+        float stepY = steps > 0 ? (y2 - y1) / steps : 0;
+        int size = std::max(lineWidth, 1);
+        for (int i = 0; i <= steps; i++) {
+            Plot(x1 + stepX * i, y1 + stepY * i, size);
+        }
+    }
+
+    // Binary PPM (P6), top row first
+    static bool WritePPM(const std::string& path)
+    {
+        FILE* file = fopen(path.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        fprintf(file, "P6\n%d %d\n255\n", width, height);
+        List<unsigned char> row = List<unsigned char>((size_t)width * 3);
+        for (int y = 0; y < height; y++)
+        {
+            const uint32_t* pixels = &colorBuffer[(size_t)y * width];
+            for (int x = 0; x < width; x++)
+            {
+                row[x * 3] = (unsigned char)(pixels[x] & 0xFF);
+                row[x * 3 + 1] = (unsigned char)((pixels[x] >> 8) & 0xFF);
+                row[x * 3 + 2] = (unsigned char)((pixels[x] >> 16) & 0xFF);
+            }
+            fwrite(row.data(), 1, row.size(), file);
+        }
+        return fclose(file) == 0;
+    }
+};
+int Rasterizer::width = 0;
+int Rasterizer::height = 0;
+List<uint32_t> Rasterizer::colorBuffer;
+List<float> Rasterizer::depthBuffer;
+bool Rasterizer::depthTest = true;
+uint32_t Rasterizer::drawColor = 0xFFFFFFFF;
+int Rasterizer::lineWidth = 1;
+int Rasterizer::pointSize = 1;
+bool Rasterizer::binning = true;
+bool Rasterizer::simd = true;
+List<float> Rasterizer::setupX[3];
+List<float> Rasterizer::setupY[3];
+List<List<List<uint32_t>>> Rasterizer::bins;
+
+#endif
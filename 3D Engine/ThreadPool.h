@@ -0,0 +1,155 @@
+#pragma once
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <vector>
+/*
+    Fixed set of worker threads shared by the whole engine (one per hardware thread, minus the main thread).
+    - Submit(job) queues a job and returns immediately.
+    - ParallelFor(count, grainSize, func) splits [0, count) into chunks and blocks until every chunk ran.
+      The calling thread works on chunks too, so it never waits on a queue that is busy with other jobs.
+*/
+class ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    ThreadPool()
+    {
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        unsigned int count = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+        for (unsigned int i = 0; i < count; i++)
+        {
+            workers.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+
+    void WorkerLoop()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+public:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size(); i++)
+        {
+            workers[i].join();
+        }
+    }
+
+    static ThreadPool& Instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // Worker threads, not counting the calling thread.
+    int WorkerCount() { return (int)workers.size(); }
+
+    void Submit(std::function<void()> job)
+    {
+        if (workers.empty())
+        {
+            job();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.emplace_back(std::move(job));
+        }
+        wake.notify_one();
+    }
+
+    // Calls func(begin, end) for consecutive ranges covering [0, count), each at least grainSize long (except the last).
+    void ParallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& func)
+    {
+        if (grainSize < 1) {
+            grainSize = 1;
+        }
+        size_t chunks = (count + grainSize - 1) / grainSize;
+        if (chunks <= 1 || workers.empty())
+        {
+            if (count > 0) {
+                func(0, count);
+            }
+            return;
+        }
+
+        // Shared with the helper jobs, which may only get dequeued after this call has returned.
+        struct Work
+        {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            size_t chunks;
+            size_t count;
+            size_t grainSize;
+            const std::function<void(size_t, size_t)>* func;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto work = std::make_shared<Work>();
+        work->chunks = chunks;
+        work->count = count;
+        work->grainSize = grainSize;
+        work->func = &func;
+
+        auto run = [](Work& w)
+        {
+            size_t chunk;
+            while ((chunk = w.next.fetch_add(1)) < w.chunks)
+            {
+                size_t begin = chunk * w.grainSize;
+                size_t end = begin + w.grainSize < w.count ? begin + w.grainSize : w.count;
+                (*w.func)(begin, end);
+                if (w.done.fetch_add(1) + 1 == w.chunks)
+                {
+                    std::lock_guard<std::mutex> lock(w.mutex);
+                    w.finished.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = chunks - 1 < workers.size() ? chunks - 1 : workers.size();
+        for (size_t i = 0; i < helpers; i++)
+        {
+            Submit([work, run]() { run(*work); });
+        }
+        run(*work);
+
+        std::unique_lock<std::mutex> lock(work->mutex);
+        work->finished.wait(lock, [&work]() { return work->done.load() == work->chunks; });
+    }
+};
+
+#endif